@@ -8,6 +8,7 @@
 #include <GLES2/gl2.h>
 
 #include FT_STROKER_H
+#include FT_ADVANCES_H
 
 void init_egl(state_t *s)
 {
@@ -89,12 +90,13 @@ void init_egl(state_t *s)
 	assert(EGL_FALSE != result);
 
 	// freetype
-	assert(!FT_Init_FreeType(&s->freetype));
+	s->freetype = ramefont_init();
+	assert(s->freetype);
 }
 
 void fini_egl(state_t *s)
 {
-	FT_Done_FreeType(s->freetype);
+	ramefont_done();
 	glClear(GL_COLOR_BUFFER_BIT);
 	eglSwapBuffers(s->display, s->surface);
 	eglMakeCurrent(s->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
@@ -108,15 +110,9 @@ static VGfloat float_from_26_6(FT_Pos x)
 	return (VGfloat)x / 64.0f;
 }
 
-struct path_data {
-	int n_segs, n_coords;
-	VGubyte segs[256];
-	VGfloat coords[4*1024];
-};
-
 static int vg_move_to(const FT_Vector *to, void *user)
 {
-	struct path_data *p = user;
+	font_scratch_t *p = user;
 	p->segs[p->n_segs++] = VG_MOVE_TO;
 	p->coords[p->n_coords++] = float_from_26_6(to->x);
 	p->coords[p->n_coords++] = float_from_26_6(to->y);
@@ -125,7 +121,7 @@ static int vg_move_to(const FT_Vector *to, void *user)
 
 static int vg_line_to(const FT_Vector *to, void *user)
 {
-	struct path_data *p = user;
+	font_scratch_t *p = user;
 	p->segs[p->n_segs++] = VG_LINE_TO;
 	p->coords[p->n_coords++] = float_from_26_6(to->x);
 	p->coords[p->n_coords++] = float_from_26_6(to->y);
@@ -134,7 +130,7 @@ static int vg_line_to(const FT_Vector *to, void *user)
 
 static int vg_conic_to(const FT_Vector *control, const FT_Vector *to, void *user)
 {
-	struct path_data *p = user;
+	font_scratch_t *p = user;
 	p->segs[p->n_segs++] = VG_QUAD_TO;
 	p->coords[p->n_coords++] = float_from_26_6(control->x);
 	p->coords[p->n_coords++] = float_from_26_6(control->y);
@@ -145,7 +141,7 @@ static int vg_conic_to(const FT_Vector *control, const FT_Vector *to, void *user
 
 static int vg_cubic_to(const FT_Vector *c1, const FT_Vector *c2, const FT_Vector *to, void *user)
 {
-	struct path_data *p = user;
+	font_scratch_t *p = user;
 	p->segs[p->n_segs++] = VG_CUBIC_TO;
 	p->coords[p->n_coords++] = float_from_26_6(c1->x);
 	p->coords[p->n_coords++] = float_from_26_6(c1->y);
@@ -156,6 +152,57 @@ static int vg_cubic_to(const FT_Vector *c1, const FT_Vector *c2, const FT_Vector
 	return 0;
 }
 
+/* Returns buf grown to hold at least need elements, or NULL when out of
+ * memory, in which case buf and *size are left as they were. */
+static void *scratch_grow(void *buf, int *size, int need, size_t elem_size)
+{
+	void *n;
+	int new_size = *size ? *size : 64;
+
+	if (buf && need <= *size) return buf;
+	while (new_size < need) new_size *= 2;
+	n = realloc(buf, new_size * elem_size);
+	if (!n) return NULL;
+	*size = new_size;
+	return n;
+}
+
+static int scratch_reserve_run(font_scratch_t *p, int len)
+{
+	VGuint *glyphs;
+	VGfloat *adjx, *adjy;
+	int size;
+
+	if (len <= p->run_size) return 0;
+	size = p->run_size;
+	if (!(glyphs = scratch_grow(p->glyphs, &size, len, sizeof *glyphs))) return -1;
+	p->glyphs = glyphs;
+	size = p->run_size;
+	if (!(adjx = scratch_grow(p->adjx, &size, len, sizeof *adjx))) return -1;
+	p->adjx = adjx;
+	size = p->run_size;
+	if (!(adjy = scratch_grow(p->adjy, &size, len, sizeof *adjy))) return -1;
+	p->adjy = adjy;
+	p->run_size = size;
+	return 0;
+}
+
+/* Decomposition emits a move per contour and at most one segment per point
+ * plus the closing one, with up to 6 coordinates (cubic) per segment. */
+static int scratch_reserve_outline(font_scratch_t *p, const FT_Outline *outline)
+{
+	int max_segs = outline->n_points + 2 * outline->n_contours;
+	VGubyte *segs;
+	VGfloat *coords;
+
+	if (!(segs = scratch_grow(p->segs, &p->segs_size, max_segs, sizeof *segs))) return -1;
+	p->segs = segs;
+	if (!(coords = scratch_grow(p->coords, &p->coords_size, 6 * max_segs, sizeof *coords))) return -1;
+	p->coords = coords;
+	p->n_segs = p->n_coords = 0;
+	return 0;
+}
+
 static const FT_Outline_Funcs outline_funcs = {
 	.move_to = vg_move_to,
 	.line_to = vg_line_to,
@@ -163,9 +210,15 @@ static const FT_Outline_Funcs outline_funcs = {
 	.cubic_to = vg_cubic_to,
 };
 
-fontdata_t *font_load(state_t *s, const char *name, int face_index, unsigned int size)
+static void font_load_glyph(fontdata_t *f, int index);
+static int font_char_index(fontdata_t *f, wchar_t c);
+
+fontdata_t *font_load(state_t *s, const char *name, int face_index, unsigned int size, const wchar_t *preload)
 {
+	FT_UInt index;
 	char filename[256];
+	int i;
+
 	snprintf(filename, 256, "/usr/share/fonts/TTF/%s.ttf", name);
 
 	fontdata_t *f = calloc(1, sizeof(fontdata_t));
@@ -173,12 +226,22 @@ fontdata_t *font_load(state_t *s, const char *name, int face_index, unsigned int
 
 	f->font = vgCreateFont(0);
 	assert(f->font != VG_INVALID_HANDLE);
-	assert(!FT_New_Face(s->freetype, filename, face_index, &f->face));
+	assert(!ramefont_open_face(filename, face_index, &f->face));
 	assert(!FT_Set_Pixel_Sizes(f->face, 0, size));
 
 	f->height = float_from_26_6(f->face->size->metrics.height);
 	f->ascender = float_from_26_6(f->face->size->metrics.ascender);
 	f->descender = float_from_26_6(f->face->size->metrics.descender);
+
+	for (i = 0; i < CMAP_DENSE_SIZE; i++)
+		f->cmap_dense[i] = FT_Get_Char_Index(f->face, i);
+
+	/* convert the glyphs needed for the first frame in one batch */
+	for (; preload && *preload; preload++)
+		if ((index = font_char_index(f, *preload)) != 0)
+			font_load_glyph(f, index);
+
+	f->warmup_char = FT_Get_First_Char(f->face, &f->warmup_index);
 	return f;
 }
 
@@ -186,39 +249,119 @@ void font_unload(fontdata_t *f)
 {
 	int i;
 
-	for (i = 0; i < sizeof(f->loaded_map)/sizeof(f->loaded_map[0]); i++)
+	for (i = 0; i < sizeof(f->loaded_map)/sizeof(f->loaded_map[0]); i++) {
 		free(f->loaded_map[i]);
-	FT_Done_Face(f->face);
+		free(f->advance_map[i]);
+	}
+	for (i = 0; i < EXTENT_CACHE_SIZE; i++)
+		free(f->extent_cache[i].text);
+	free(f->scratch.glyphs);
+	free(f->scratch.adjx);
+	free(f->scratch.adjy);
+	free(f->scratch.segs);
+	free(f->scratch.coords);
+	ramefont_done_face(f->face);
 	vgDestroyFont(f->font);
+	free(f);
+}
+
+/* glyph index of a character, without going to the cmap after the first time */
+static int font_char_index(fontdata_t *f, wchar_t c)
+{
+	glyph_cmap_t *m;
+
+	if ((uint32_t)c < CMAP_DENSE_SIZE)
+		return f->cmap_dense[c];
+
+	m = &f->cmap_cache[(uint32_t)c % CMAP_CACHE_SIZE];
+	if (m->code != c) {
+		m->code = c;
+		m->index = FT_Get_Char_Index(f->face, c);
+	}
+	return m->index;
+}
+
+/* the flag and advance maps cover glyph indices below 1<<16 only */
+static uint8_t *glyph_flags(fontdata_t *f, int index)
+{
+	uint8_t **page;
+
+	if (index >= 1<<16) return NULL;
+	page = &f->loaded_map[index >> LM_SIZE];
+	if (!*page) *page = calloc(1, sizeof(uint8_t[1<<LM_SIZE]));
+	if (!*page) return NULL;
+	return &(*page)[index & ((1<<LM_SIZE)-1)];
+}
+
+/* advance of a glyph, loaded from FreeType once; indices beyond the
+ * maps are asked from FreeType every time */
+static void font_get_advance(fontdata_t *f, int index, VGfloat *x, VGfloat *y)
+{
+	VGfloat **page;
+	VGfloat *adv;
+	uint8_t *flags;
+	FT_Fixed advance;
+
+	flags = glyph_flags(f, index);
+	page = flags ? &f->advance_map[index >> LM_SIZE] : NULL;
+	if (page && !*page) *page = malloc(sizeof(VGfloat[2<<LM_SIZE]));
+	if (!page || !*page) {
+		*x = *y = 0.0f;
+		if (FT_Get_Advance(f->face, index, FT_LOAD_DEFAULT, &advance) == 0)
+			*x = (VGfloat) advance / 65536.0f;
+		return;
+	}
+
+	adv = &(*page)[2 * (index & ((1<<LM_SIZE)-1))];
+	if (!(*flags & GLYPH_ADVANCE_CACHED)) {
+		FT_Load_Glyph(f->face, index, FT_LOAD_DEFAULT);
+		adv[0] = float_from_26_6(f->face->glyph->advance.x);
+		adv[1] = float_from_26_6(f->face->glyph->advance.y);
+		*flags |= GLYPH_ADVANCE_CACHED;
+	}
+	*x = adv[0];
+	*y = adv[1];
+}
+
+static void font_get_kerning(fontdata_t *f, int prev, int cur, VGfloat *x, VGfloat *y)
+{
+	uint64_t key = ((uint64_t)(uint32_t)prev << 32) | (uint32_t)cur;
+	glyph_kerning_t *k = &f->kern_cache[key % KERN_CACHE_SIZE];
+	FT_Vector kerning;
+
+	if (k->key != key) {
+		k->key = key;
+		k->x = k->y = 0.0f;
+		if (FT_Get_Kerning(f->face, prev, cur, FT_KERNING_DEFAULT, &kerning) == 0) {
+			k->x = float_from_26_6(kerning.x);
+			k->y = float_from_26_6(kerning.y);
+		}
+	}
+	*x = k->x;
+	*y = k->y;
 }
 
 static void font_load_glyph(fontdata_t *f, int index)
 {
-	static struct path_data pd;
+	font_scratch_t *pd = &f->scratch;
 	VGPath path;
 	FT_Outline *outline;
-	int mapa, mapb, mapc;
-
-	if (index > 1<<16) return;
+	uint8_t *flags;
 
-	mapa = index >> LM_SIZE;
-	mapb = index & ((1<<LM_SIZE)-1);
-	mapc = 1 << (index & 7);
-	if (!f->loaded_map[mapa]) f->loaded_map[mapa] = calloc(1, sizeof(uint8_t[1<<LM_SIZE]));
-	if (f->loaded_map[mapa][mapb] & mapc) return;
-	f->loaded_map[mapa][mapb] |= mapc;
+	flags = glyph_flags(f, index);
+	if (!flags || (*flags & GLYPH_PATH_LOADED)) return;
+	*flags |= GLYPH_PATH_LOADED;
 
 	FT_Load_Glyph(f->face, index, FT_LOAD_NO_BITMAP|FT_LOAD_NO_HINTING);
 
 	outline = &f->face->glyph->outline;
 	path = VG_INVALID_HANDLE;
-	if (outline->n_contours != 0) {
+	if (outline->n_contours != 0 && scratch_reserve_outline(pd, outline) == 0) {
 		path = vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_F,
 				    1.0f, 0.0f, 0, 0, VG_PATH_CAPABILITY_ALL);
 		assert(path != VG_INVALID_HANDLE);
-		pd.n_segs = pd.n_coords = 0;
-		FT_Outline_Decompose(outline, &outline_funcs, (void *) &pd);
-		vgAppendPathData(path, pd.n_segs, pd.segs, pd.coords);
+		FT_Outline_Decompose(outline, &outline_funcs, (void *) pd);
+		vgAppendPathData(path, pd->n_segs, pd->segs, pd->coords);
 	}
 
 	VGfloat glyphOrigin[2] = {0.0f, 0.0f};
@@ -229,48 +372,102 @@ static void font_load_glyph(fontdata_t *f, int index)
 	vgSetGlyphToPath(f->font, index, path, 0, glyphOrigin, escapement);
 }
 
+/* Converts the glyphs of a whole code point range, such as a script block
+ * the text to come is known to be written in, in one batch. */
+void font_preload_range(fontdata_t *f, wchar_t first, wchar_t last)
+{
+	FT_UInt index;
+	wchar_t c;
+
+	for (c = first; c <= last && c >= first; c++)
+		if ((index = font_char_index(f, c)) != 0)
+			font_load_glyph(f, index);
+}
+
+/* Converts up to max_glyphs not yet loaded glyphs of the font's charmap.
+ * Meant to be called between frames from the thread owning the VG
+ * context; returns nonzero while glyphs remain. */
+int font_warmup(fontdata_t *f, int max_glyphs)
+{
+	uint8_t *flags;
+
+	while (f->warmup_index && max_glyphs > 0) {
+		flags = glyph_flags(f, f->warmup_index);
+		if (flags && !(*flags & GLYPH_PATH_LOADED)) {
+			font_load_glyph(f, f->warmup_index);
+			max_glyphs--;
+		}
+		f->warmup_char = FT_Get_Next_Char(f->face, f->warmup_char, &f->warmup_index);
+	}
+	return f->warmup_index != 0;
+}
+
+static uint32_t text_hash(const wchar_t *text)
+{
+	uint32_t h = 2166136261u;
+
+	while (*text)
+		h = (h ^ (uint32_t)*text++) * 16777619u;
+	return h;
+}
+
 void font_get_text_extent(fontdata_t *f, const wchar_t *text, VGfloat *w, VGfloat *h)
 {
-	FT_Vector kerning;
-	VGfloat x = 0, y = 0;
-	int i, prev = 0, len = wcslen(text), cur;
+	text_extent_t *e = &f->extent_cache[text_hash(text) % EXTENT_CACHE_SIZE];
+	VGfloat x = 0, y = 0, kx, ky, ax, ay;
+	int i, prev = 0, len, cur;
+
+	if (e->text && !wcscmp(e->text, text)) {
+		*w = e->w;
+		*h = e->h;
+		return;
+	}
 
+	len = wcslen(text);
 	for (i = 0; i < len; i++) {
-		cur = FT_Get_Char_Index(f->face, text[i]);
+		cur = font_char_index(f, text[i]);
 		if (cur) {
-			if (prev && FT_Get_Kerning(f->face, prev, cur, FT_KERNING_DEFAULT, &kerning) == 0) {
-				x += float_from_26_6(kerning.x);
-				y += float_from_26_6(kerning.y);
+			if (prev) {
+				font_get_kerning(f, prev, cur, &kx, &ky);
+				x += kx;
+				y += ky;
 			}
-			FT_Load_Glyph(f->face, cur, FT_LOAD_DEFAULT);
-			x += float_from_26_6(f->face->glyph->advance.x);
-			y += float_from_26_6(f->face->glyph->advance.y);
+			font_get_advance(f, cur, &ax, &ay);
+			x += ax;
+			y += ay;
 		}
 		prev = cur;
 	}
 	y -= f->height;
 	*w = x;
 	*h = -y;
+
+	free(e->text);
+	e->text = wcsdup(text);
+	e->w = *w;
+	e->h = *h;
 }
 
 void font_draw_text(fontdata_t *f, const wchar_t *text, VGfloat x, VGfloat y, VGbitfield paint_mode)
 {
-	VGuint glyphs[256];
-	VGfloat adjx[256], adjy[256];
+	font_scratch_t *s = &f->scratch;
+	VGuint *glyphs;
+	VGfloat *adjx, *adjy;
 	VGfloat origin[2] = {x, y+(f->height-f->ascender-f->descender)/2};
-	FT_Vector kerning;
 	int i, prev = 0, len = wcslen(text), cur;
 
+	if (scratch_reserve_run(s, len)) return;
+	glyphs = s->glyphs;
+	adjx = s->adjx;
+	adjy = s->adjy;
 	for (i = 0; i < len; i++) {
-		glyphs[i] = cur = FT_Get_Char_Index(f->face, text[i]);
+		glyphs[i] = cur = font_char_index(f, text[i]);
 		adjx[i] = 0.0f;
 		adjy[i] = 0.0f;
 		if (cur) {
 			font_load_glyph(f, cur);
-			if (i && FT_Get_Kerning(f->face, prev, cur, FT_KERNING_DEFAULT, &kerning) == 0) {
-				adjx[i-1] = float_from_26_6(kerning.x);
-				adjy[i-1] = float_from_26_6(kerning.y);
-			}
+			if (i && prev)
+				font_get_kerning(f, prev, cur, &adjx[i-1], &adjy[i-1]);
 		}
 		prev = cur;
 	}
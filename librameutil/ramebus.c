@@ -0,0 +1,520 @@
+#include "ramebus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <mosquitto.h>
+
+#define RAMEBUS_MAX_SUBS	8
+#define RAMEBUS_KEEPALIVE	60	/* seconds */
+#define RAMEBUS_MISC_INTERVAL_MS 1000	/* keepalive and retry housekeeping */
+#define RAMEBUS_BACKOFF_MIN_MS	1000
+#define RAMEBUS_BACKOFF_MAX_MS	30000
+#define RAMEBUS_PAYLOAD_SIZE	16
+
+static const char *stopwatch_cmds[] = { "start", "stop", "lap", "reset" };
+
+/* message held by the loopback, queued or retained */
+struct local_msg {
+	struct local_msg *next;
+	char *topic;
+	int len;
+	char payload[];
+};
+
+struct ramebus {
+	ramebus_handler handler;
+	void *user;
+	char *subs[RAMEBUS_MAX_SUBS];
+	int num_subs;
+	struct local_msg *will;
+	int will_retain;
+
+	/* broker connection */
+	struct mosquitto *mosq;
+	int connected;
+	long long retry_at;	/* CLOCK_MONOTONIC ms of the next reconnect */
+	int backoff_ms;
+
+	/* in-process loopback */
+	int local;
+	int event_fd;
+	int connect_pending;
+	struct local_msg *queue, **queue_tail;
+	struct ramebus *local_next;
+};
+
+static struct ramebus *local_buses;
+static struct local_msg *local_retained;
+static int mosquitto_users;
+
+long long ramebus_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Matches level by level; '+' takes one level, which may be empty, and
+ * '#' the rest, including none at all ("a/#" matches "a"). */
+int ramebus_topic_match(const char *sub, const char *topic)
+{
+	for (;;) {
+		if (*sub == '#')
+			return 1;
+		if (*sub == '+') {
+			sub++;
+			while (*topic && *topic != '/') topic++;
+		} else {
+			while (*sub && *sub != '/' && *sub == *topic) {
+				sub++;
+				topic++;
+			}
+			if ((*sub && *sub != '/') || (*topic && *topic != '/'))
+				return 0;
+		}
+		/* both are at the end of a level */
+		if (!*sub)
+			return !*topic;
+		if (!*topic)
+			return !strcmp(sub, "/#");
+		sub++;
+		topic++;
+	}
+}
+
+static int subscribed(struct ramebus *bus, const char *topic)
+{
+	int i;
+
+	for (i = 0; i < bus->num_subs; i++)
+		if (ramebus_topic_match(bus->subs[i], topic))
+			return 1;
+	return 0;
+}
+
+int ramebus_encode(const struct ramebus_msg *msg, const char **topic, char *buf, int size)
+{
+	const char *s;
+	int len;
+
+	switch (msg->type) {
+	case RAMEBUS_MSG_ALERT:
+		if (msg->alert < RAMEBUS_ALERT_NONE || msg->alert > RAMEBUS_ALERT_BLINK || size < 1)
+			return -1;
+		*topic = msg->topic ? msg->topic : RAMEBUS_TOPIC_ALERT;
+		buf[0] = '0' + msg->alert;
+		return 1;
+	case RAMEBUS_MSG_STOPWATCH:
+		if (msg->stopwatch < RAMEBUS_STOPWATCH_START || msg->stopwatch > RAMEBUS_STOPWATCH_RESET)
+			return -1;
+		*topic = msg->topic ? msg->topic : RAMEBUS_TOPIC_STOPWATCH;
+		s = stopwatch_cmds[msg->stopwatch];
+		len = strlen(s);
+		if (len > size) return -1;
+		memcpy(buf, s, len);
+		return len;
+	case RAMEBUS_MSG_RAW:
+		if (!msg->topic || msg->raw.len > size) return -1;
+		*topic = msg->topic;
+		memcpy(buf, msg->raw.data, msg->raw.len);
+		return msg->raw.len;
+	default:
+		return -1;
+	}
+}
+
+int ramebus_decode(const char *topic, const void *payload, int len, struct ramebus_msg *msg)
+{
+	const char *p = payload;
+	int i;
+
+	msg->topic = topic;
+	if (!strcmp(topic, RAMEBUS_TOPIC_ALERT) && len >= 1 && p[0] >= '0' && p[0] <= '2') {
+		msg->type = RAMEBUS_MSG_ALERT;
+		msg->alert = p[0] - '0';
+		return 0;
+	}
+	if (!strcmp(topic, RAMEBUS_TOPIC_STOPWATCH)) {
+		for (i = 0; i < sizeof(stopwatch_cmds) / sizeof(stopwatch_cmds[0]); i++) {
+			if (len == strlen(stopwatch_cmds[i]) && !memcmp(p, stopwatch_cmds[i], len)) {
+				msg->type = RAMEBUS_MSG_STOPWATCH;
+				msg->stopwatch = i;
+				return 0;
+			}
+		}
+	}
+	msg->type = RAMEBUS_MSG_RAW;
+	msg->raw.data = payload;
+	msg->raw.len = len;
+	return 0;
+}
+
+static void deliver(struct ramebus *bus, const char *topic, const void *payload, int len)
+{
+	struct ramebus_msg msg;
+
+	if (!ramebus_decode(topic, payload, len, &msg))
+		bus->handler(bus, &msg, bus->user);
+}
+
+static void notify_connection(struct ramebus *bus, int connected)
+{
+	struct ramebus_msg msg = { .type = RAMEBUS_MSG_CONNECTION, .connected = connected };
+
+	bus->connected = connected;
+	bus->handler(bus, &msg, bus->user);
+}
+
+/* loopback */
+
+static struct local_msg *local_msg_new(const char *topic, const void *payload, int len)
+{
+	struct local_msg *m = malloc(sizeof(*m) + len);
+
+	if (!m) return NULL;
+	m->topic = strdup(topic);
+	if (!m->topic) {
+		free(m);
+		return NULL;
+	}
+	m->next = NULL;
+	m->len = len;
+	memcpy(m->payload, payload, len);
+	return m;
+}
+
+static void local_msg_free(struct local_msg *m)
+{
+	if (!m) return;
+	free(m->topic);
+	free(m);
+}
+
+static void local_enqueue(struct ramebus *bus, const char *topic, const void *payload, int len)
+{
+	struct local_msg *m = local_msg_new(topic, payload, len);
+
+	if (!m) return;
+	*bus->queue_tail = m;
+	bus->queue_tail = &m->next;
+	eventfd_write(bus->event_fd, 1);
+}
+
+static void local_retain(const char *topic, const void *payload, int len)
+{
+	struct local_msg **p, *m;
+
+	for (p = &local_retained; *p; p = &(*p)->next) {
+		if (!strcmp((*p)->topic, topic)) {
+			m = *p;
+			*p = m->next;
+			local_msg_free(m);
+			break;
+		}
+	}
+	/* as in MQTT, an empty retained message clears the topic */
+	if (len && (m = local_msg_new(topic, payload, len)) != NULL) {
+		m->next = local_retained;
+		local_retained = m;
+	}
+}
+
+static void local_publish(const char *topic, const void *payload, int len, int retain)
+{
+	struct ramebus *bus;
+
+	if (retain)
+		local_retain(topic, payload, len);
+	for (bus = local_buses; bus; bus = bus->local_next)
+		if (subscribed(bus, topic))
+			local_enqueue(bus, topic, payload, len);
+}
+
+static void local_send_retained(struct ramebus *bus, const char *sub)
+{
+	struct local_msg *m;
+
+	for (m = local_retained; m; m = m->next)
+		if (ramebus_topic_match(sub, m->topic))
+			local_enqueue(bus, m->topic, m->payload, m->len);
+}
+
+static int local_connect(struct ramebus *bus)
+{
+	int i;
+
+	bus->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (bus->event_fd < 0) return -1;
+	bus->local = 1;
+	bus->local_next = local_buses;
+	local_buses = bus;
+	for (i = 0; i < bus->num_subs; i++)
+		local_send_retained(bus, bus->subs[i]);
+	bus->connect_pending = 1;
+	eventfd_write(bus->event_fd, 1);
+	return 0;
+}
+
+static void local_service(struct ramebus *bus)
+{
+	struct local_msg *m;
+	eventfd_t count;
+
+	eventfd_read(bus->event_fd, &count);
+	if (bus->connect_pending) {
+		bus->connect_pending = 0;
+		notify_connection(bus, 1);
+	}
+	/* one at a time, the handler may publish more */
+	while ((m = bus->queue) != NULL) {
+		bus->queue = m->next;
+		if (!bus->queue) bus->queue_tail = &bus->queue;
+		deliver(bus, m->topic, m->payload, m->len);
+		local_msg_free(m);
+	}
+}
+
+static void local_disconnect(struct ramebus *bus)
+{
+	struct ramebus **p;
+	struct local_msg *m;
+
+	for (p = &local_buses; *p; p = &(*p)->local_next) {
+		if (*p == bus) {
+			*p = bus->local_next;
+			break;
+		}
+	}
+	while ((m = bus->queue) != NULL) {
+		bus->queue = m->next;
+		local_msg_free(m);
+	}
+	if (bus->will)
+		local_publish(bus->will->topic, bus->will->payload, bus->will->len, bus->will_retain);
+	close(bus->event_fd);
+}
+
+/* broker */
+
+static void on_connect(struct mosquitto *mosq, void *data, int status)
+{
+	struct ramebus *bus = data;
+	int i;
+
+	if (status) return;
+	bus->backoff_ms = RAMEBUS_BACKOFF_MIN_MS;
+	for (i = 0; i < bus->num_subs; i++)
+		mosquitto_subscribe(mosq, NULL, bus->subs[i], 1);
+	notify_connection(bus, 1);
+}
+
+static void on_disconnect(struct mosquitto *mosq, void *data, int status)
+{
+	struct ramebus *bus = data;
+
+	if (bus->connected)
+		notify_connection(bus, 0);
+}
+
+static void on_message(struct mosquitto *mosq, void *data, const struct mosquitto_message *msg)
+{
+	deliver(data, msg->topic, msg->payload, msg->payloadlen);
+}
+
+/* Schedules the next attempt, doubling the delay up to the maximum. */
+static void broker_lost(struct ramebus *bus)
+{
+	if (bus->connected)
+		notify_connection(bus, 0);
+	bus->retry_at = ramebus_now_ms() + bus->backoff_ms;
+	bus->backoff_ms *= 2;
+	if (bus->backoff_ms > RAMEBUS_BACKOFF_MAX_MS)
+		bus->backoff_ms = RAMEBUS_BACKOFF_MAX_MS;
+}
+
+static int broker_connect(struct ramebus *bus, const char *broker)
+{
+	char host[256], *colon;
+	int port = RAMEBUS_DEFAULT_PORT;
+
+	snprintf(host, sizeof(host), "%s", broker);
+	if ((colon = strrchr(host, ':')) != NULL) {
+		*colon = 0;
+		port = atoi(colon + 1);
+	}
+
+	if (!mosquitto_users++)
+		mosquitto_lib_init();
+	bus->mosq = mosquitto_new(NULL, true, bus);
+	if (!bus->mosq) return -1;
+	mosquitto_connect_callback_set(bus->mosq, on_connect);
+	mosquitto_disconnect_callback_set(bus->mosq, on_disconnect);
+	mosquitto_message_callback_set(bus->mosq, on_message);
+	if (bus->will)
+		mosquitto_will_set(bus->mosq, bus->will->topic, bus->will->len,
+				   bus->will->payload, 1, bus->will_retain);
+
+	bus->backoff_ms = RAMEBUS_BACKOFF_MIN_MS;
+	if (mosquitto_connect_async(bus->mosq, host, port, RAMEBUS_KEEPALIVE) != MOSQ_ERR_SUCCESS)
+		broker_lost(bus);
+	return 0;
+}
+
+static void broker_service(struct ramebus *bus, short revents)
+{
+	int rc = MOSQ_ERR_SUCCESS;
+
+	/* libmosquitto works out the packet count to read by itself; each
+	 * message reaches the handler as it is read, batching is up to it */
+	if (revents & (POLLIN | POLLERR | POLLHUP))
+		rc = mosquitto_loop_read(bus->mosq, 1);
+	if (rc == MOSQ_ERR_SUCCESS && (revents & POLLOUT))
+		rc = mosquitto_loop_write(bus->mosq, 1);
+	if (rc == MOSQ_ERR_SUCCESS)
+		rc = mosquitto_loop_misc(bus->mosq);
+	if (rc == MOSQ_ERR_SUCCESS && mosquitto_socket(bus->mosq) >= 0)
+		return;
+
+	if (!bus->retry_at)
+		broker_lost(bus);
+	if (ramebus_now_ms() >= bus->retry_at) {
+		bus->retry_at = 0;
+		if (mosquitto_reconnect_async(bus->mosq) != MOSQ_ERR_SUCCESS)
+			broker_lost(bus);
+	}
+}
+
+/* public interface */
+
+struct ramebus *ramebus_new(ramebus_handler handler, void *user)
+{
+	struct ramebus *bus = calloc(1, sizeof(*bus));
+
+	if (!bus) return NULL;
+	bus->handler = handler;
+	bus->user = user;
+	bus->event_fd = -1;
+	bus->queue_tail = &bus->queue;
+	return bus;
+}
+
+void ramebus_free(struct ramebus *bus)
+{
+	int i;
+
+	if (!bus) return;
+	if (bus->local)
+		local_disconnect(bus);
+	if (bus->mosq) {
+		mosquitto_destroy(bus->mosq);
+		if (!--mosquitto_users)
+			mosquitto_lib_cleanup();
+	}
+	for (i = 0; i < bus->num_subs; i++)
+		free(bus->subs[i]);
+	local_msg_free(bus->will);
+	free(bus);
+}
+
+int ramebus_subscribe(struct ramebus *bus, const char *topic)
+{
+	if (bus->num_subs == RAMEBUS_MAX_SUBS) return -1;
+	bus->subs[bus->num_subs] = strdup(topic);
+	if (!bus->subs[bus->num_subs]) return -1;
+	bus->num_subs++;
+
+	if (bus->local)
+		local_send_retained(bus, topic);
+	else if (bus->connected)
+		mosquitto_subscribe(bus->mosq, NULL, topic, 1);
+	return 0;
+}
+
+int ramebus_set_will(struct ramebus *bus, const struct ramebus_msg *msg, int retain)
+{
+	char buf[RAMEBUS_PAYLOAD_SIZE];
+	const char *topic;
+	int len;
+
+	len = ramebus_encode(msg, &topic, buf, sizeof(buf));
+	if (len < 0) return -1;
+	local_msg_free(bus->will);
+	bus->will = local_msg_new(topic, buf, len);
+	bus->will_retain = retain;
+	if (bus->will && bus->mosq)
+		mosquitto_will_set(bus->mosq, topic, len, buf, 1, retain);
+	return bus->will ? 0 : -1;
+}
+
+int ramebus_connect(struct ramebus *bus, const char *broker)
+{
+	if (!strcmp(broker, RAMEBUS_LOCAL))
+		return local_connect(bus);
+	return broker_connect(bus, broker);
+}
+
+int ramebus_publish(struct ramebus *bus, const struct ramebus_msg *msg, int retain)
+{
+	char buf[RAMEBUS_PAYLOAD_SIZE];
+	const char *topic;
+	int len;
+
+	if (msg->type == RAMEBUS_MSG_RAW) {
+		if (!msg->topic) return -1;
+		topic = msg->topic;
+		len = msg->raw.len;
+		if (bus->local) {
+			local_publish(topic, msg->raw.data, len, retain);
+			return 0;
+		}
+		return bus->mosq && mosquitto_publish(bus->mosq, NULL, topic, len, msg->raw.data, 1, retain) == MOSQ_ERR_SUCCESS ? 0 : -1;
+	}
+
+	len = ramebus_encode(msg, &topic, buf, sizeof(buf));
+	if (len < 0) return -1;
+	if (bus->local) {
+		local_publish(topic, buf, len, retain);
+		return 0;
+	}
+	return bus->mosq && mosquitto_publish(bus->mosq, NULL, topic, len, buf, 1, retain) == MOSQ_ERR_SUCCESS ? 0 : -1;
+}
+
+int ramebus_fd(struct ramebus *bus)
+{
+	if (bus->local) return bus->event_fd;
+	return bus->mosq ? mosquitto_socket(bus->mosq) : -1;
+}
+
+short ramebus_events(struct ramebus *bus)
+{
+	if (bus->mosq && mosquitto_want_write(bus->mosq))
+		return POLLIN | POLLOUT;
+	return POLLIN;
+}
+
+int ramebus_timeout(struct ramebus *bus)
+{
+	long long wait;
+
+	if (!bus->mosq) return -1;
+	if (mosquitto_socket(bus->mosq) >= 0 || !bus->retry_at)
+		return RAMEBUS_MISC_INTERVAL_MS;
+	wait = bus->retry_at - ramebus_now_ms();
+	if (wait < 0) return 0;
+	return wait < RAMEBUS_MISC_INTERVAL_MS ? wait : RAMEBUS_MISC_INTERVAL_MS;
+}
+
+void ramebus_service(struct ramebus *bus, short revents)
+{
+	if (bus->local) {
+		if (revents & POLLIN)
+			local_service(bus);
+	} else if (bus->mosq) {
+		broker_service(bus, revents);
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef RAMEBUS_H
+#define RAMEBUS_H
+
+/* Client for the rame event bus, the MQTT broker the studio tools talk
+ * through. One bus holds one connection, is driven from the caller's
+ * poll loop and reconnects with backoff by itself. Messages are decoded
+ * into typed form before they reach the handler.
+ *
+ * Connecting to "local" instead of a broker host uses an in-process
+ * loopback: everything published on any local bus of the process is
+ * delivered to the local buses subscribed to it, with retained messages,
+ * so tools and tests run without a broker. */
+
+#include <poll.h>
+
+#define RAMEBUS_TOPIC_ALERT	"rame/clock/alert"
+#define RAMEBUS_TOPIC_STOPWATCH	"rame/clock/stopwatch"
+
+#define RAMEBUS_LOCAL		"local"
+#define RAMEBUS_DEFAULT_PORT	1883
+
+enum ramebus_msg_type {
+	RAMEBUS_MSG_RAW,		/* topic without a typed format */
+	RAMEBUS_MSG_ALERT,
+	RAMEBUS_MSG_STOPWATCH,
+	RAMEBUS_MSG_CONNECTION,		/* connection came up or went down */
+};
+
+/* alert states, sent as a single digit */
+enum ramebus_alert {
+	RAMEBUS_ALERT_NONE,
+	RAMEBUS_ALERT_ON,
+	RAMEBUS_ALERT_BLINK,
+};
+
+enum ramebus_stopwatch_cmd {
+	RAMEBUS_STOPWATCH_START,
+	RAMEBUS_STOPWATCH_STOP,
+	RAMEBUS_STOPWATCH_LAP,
+	RAMEBUS_STOPWATCH_RESET,
+};
+
+struct ramebus_msg {
+	enum ramebus_msg_type type;
+	const char *topic;		/* NULL: the type's default topic */
+	union {
+		int alert;		/* enum ramebus_alert */
+		int stopwatch;		/* enum ramebus_stopwatch_cmd */
+		int connected;
+		struct {
+			const void *data;
+			int len;
+		} raw;
+	};
+};
+
+struct ramebus;
+
+typedef void (*ramebus_handler)(struct ramebus *bus, const struct ramebus_msg *msg, void *user);
+
+struct ramebus *ramebus_new(ramebus_handler handler, void *user);
+void ramebus_free(struct ramebus *bus);
+
+/* Both are kept and applied on every (re)connect, so they may be set
+ * before connecting. Subscriptions accept MQTT '+' and '#' wildcards. */
+int ramebus_subscribe(struct ramebus *bus, const char *topic);
+int ramebus_set_will(struct ramebus *bus, const struct ramebus_msg *msg, int retain);
+
+/* broker is "host[:port]" or RAMEBUS_LOCAL; connects asynchronously */
+int ramebus_connect(struct ramebus *bus, const char *broker);
+
+int ramebus_publish(struct ramebus *bus, const struct ramebus_msg *msg, int retain);
+
+/* Poll loop integration: wait for ramebus_events() on ramebus_fd() (which
+ * may be -1 and changes on reconnect) for at most ramebus_timeout()
+ * milliseconds, then pass the returned events, or 0, to ramebus_service.
+ * The handler is called for every message received, so a handler driving
+ * slow outputs should only record the state and apply it on a timer. */
+int ramebus_fd(struct ramebus *bus);
+short ramebus_events(struct ramebus *bus);
+int ramebus_timeout(struct ramebus *bus);
+void ramebus_service(struct ramebus *bus, short revents);
+
+/* CLOCK_MONOTONIC milliseconds, the clock of ramebus_timeout() */
+long long ramebus_now_ms(void);
+
+/* MQTT topic filter matching with '+' (one level) and '#' (the rest),
+ * for telling apart messages of several subscriptions */
+int ramebus_topic_match(const char *sub, const char *topic);
+
+/* payload format of the typed messages */
+int ramebus_encode(const struct ramebus_msg *msg, const char **topic, char *buf, int size);
+int ramebus_decode(const char *topic, const void *payload, int len, struct ramebus_msg *msg);
+
+#endif
@@ -0,0 +1,184 @@
+/* Exercises ramebus over the in-process loopback, so no broker is needed:
+ * topic matching, retained delivery, wildcard subscriptions and, with a
+ * message count as the argument, loopback throughput. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ramebus.h"
+
+#define BENCH_DEFAULT_MESSAGES 100000
+
+struct received {
+	int connected;
+	int alerts, last_alert;
+	int stopwatch, last_stopwatch;
+	int raw;
+	char last_topic[64];
+};
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static void on_message(struct ramebus *bus, const struct ramebus_msg *msg, void *data)
+{
+	struct received *r = data;
+
+	switch (msg->type) {
+	case RAMEBUS_MSG_CONNECTION:
+		r->connected = msg->connected;
+		return;
+	case RAMEBUS_MSG_ALERT:
+		r->alerts++;
+		r->last_alert = msg->alert;
+		break;
+	case RAMEBUS_MSG_STOPWATCH:
+		r->stopwatch++;
+		r->last_stopwatch = msg->stopwatch;
+		break;
+	case RAMEBUS_MSG_RAW:
+		r->raw++;
+		break;
+	}
+	snprintf(r->last_topic, sizeof(r->last_topic), "%s", msg->topic);
+}
+
+/* what a poll loop would do once the eventfd is readable */
+static void service(struct ramebus *bus)
+{
+	ramebus_service(bus, POLLIN);
+}
+
+static void test_topic_match(void)
+{
+	CHECK(ramebus_topic_match("a/b", "a/b"));
+	CHECK(!ramebus_topic_match("a/b", "a/bc"));
+	CHECK(!ramebus_topic_match("a/bc", "a/b"));
+	CHECK(!ramebus_topic_match("a/b", "a"));
+	CHECK(ramebus_topic_match("a/+", "a/b"));
+	CHECK(ramebus_topic_match("a/+", "a/"));
+	CHECK(!ramebus_topic_match("a/+", "a"));
+	CHECK(!ramebus_topic_match("a/+", "a/b/c"));
+	CHECK(ramebus_topic_match("+/b", "/b"));
+	CHECK(ramebus_topic_match("a/+/c", "a//c"));
+	CHECK(ramebus_topic_match("a/#", "a"));
+	CHECK(ramebus_topic_match("a/#", "a/b/c"));
+	CHECK(!ramebus_topic_match("a/#", "ab"));
+	CHECK(ramebus_topic_match("#", "a/b"));
+}
+
+static void test_retained_and_wildcards(void)
+{
+	struct received rp = {0}, rs = {0}, rw = {0};
+	struct ramebus *pub, *sub, *wild;
+	struct ramebus_msg alert = { .type = RAMEBUS_MSG_ALERT, .alert = RAMEBUS_ALERT_BLINK };
+	struct ramebus_msg start = { .type = RAMEBUS_MSG_STOPWATCH, .stopwatch = RAMEBUS_STOPWATCH_START };
+	struct ramebus_msg other = { .type = RAMEBUS_MSG_RAW, .topic = "rame/other/x", .raw = { "hi", 2 } };
+	struct ramebus_msg clear = { .type = RAMEBUS_MSG_RAW, .topic = RAMEBUS_TOPIC_ALERT, .raw = { "", 0 } };
+
+	pub = ramebus_new(on_message, &rp);
+	CHECK(ramebus_connect(pub, RAMEBUS_LOCAL) == 0);
+	service(pub);
+	CHECK(rp.connected);
+
+	/* retained before anyone listens, the plain one is lost */
+	CHECK(ramebus_publish(pub, &alert, 1) == 0);
+	CHECK(ramebus_publish(pub, &other, 0) == 0);
+
+	/* subscribed before connecting: retained delivery on connect */
+	sub = ramebus_new(on_message, &rs);
+	ramebus_subscribe(sub, "rame/clock/+");
+	ramebus_connect(sub, RAMEBUS_LOCAL);
+	service(sub);
+	CHECK(rs.connected);
+	CHECK(rs.alerts == 1 && rs.last_alert == RAMEBUS_ALERT_BLINK);
+	CHECK(rs.raw == 0);
+
+	/* live messages through '+', others filtered out */
+	ramebus_publish(pub, &start, 0);
+	ramebus_publish(pub, &other, 0);
+	service(sub);
+	CHECK(rs.stopwatch == 1 && rs.last_stopwatch == RAMEBUS_STOPWATCH_START);
+	CHECK(!strcmp(rs.last_topic, RAMEBUS_TOPIC_STOPWATCH));
+	CHECK(rs.raw == 0);
+
+	/* subscribed after connecting: retained delivery on subscribe */
+	wild = ramebus_new(on_message, &rw);
+	ramebus_connect(wild, RAMEBUS_LOCAL);
+	ramebus_subscribe(wild, "rame/#");
+	service(wild);
+	CHECK(rw.alerts == 1 && rw.last_alert == RAMEBUS_ALERT_BLINK);
+	ramebus_publish(pub, &other, 0);
+	service(wild);
+	CHECK(rw.raw == 1 && !strcmp(rw.last_topic, "rame/other/x"));
+
+	/* an empty retained message clears the topic for later subscribers */
+	ramebus_publish(pub, &clear, 1);
+	service(sub);
+	service(wild);
+	ramebus_free(wild);
+	memset(&rw, 0, sizeof(rw));
+	wild = ramebus_new(on_message, &rw);
+	ramebus_subscribe(wild, "#");
+	ramebus_connect(wild, RAMEBUS_LOCAL);
+	service(wild);
+	CHECK(rw.connected && rw.alerts == 0 && rw.raw == 0);
+
+	/* the publisher subscribed to nothing and got nothing */
+	CHECK(rp.alerts == 0 && rp.stopwatch == 0 && rp.raw == 0);
+
+	ramebus_free(wild);
+	ramebus_free(sub);
+	ramebus_free(pub);
+}
+
+static void bench(int count)
+{
+	struct received rp = {0}, rs = {0};
+	struct ramebus *pub, *sub;
+	struct ramebus_msg alert = { .type = RAMEBUS_MSG_ALERT };
+	long long start, elapsed;
+	int i;
+
+	pub = ramebus_new(on_message, &rp);
+	sub = ramebus_new(on_message, &rs);
+	ramebus_subscribe(sub, RAMEBUS_TOPIC_ALERT);
+	ramebus_connect(pub, RAMEBUS_LOCAL);
+	ramebus_connect(sub, RAMEBUS_LOCAL);
+	service(sub);
+
+	start = ramebus_now_ms();
+	for (i = 0; i < count; i++) {
+		alert.alert = i % 3;
+		ramebus_publish(pub, &alert, 0);
+		service(sub);
+	}
+	elapsed = ramebus_now_ms() - start;
+	CHECK(rs.alerts == count);
+	printf("%d messages in %lld ms", count, elapsed);
+	if (elapsed > 0)
+		printf(", %lld messages/s", count * 1000LL / elapsed);
+	printf("\n");
+
+	ramebus_free(sub);
+	ramebus_free(pub);
+}
+
+int main(int argc, char **argv)
+{
+	test_topic_match();
+	test_retained_and_wildcards();
+	bench(argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_MESSAGES);
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
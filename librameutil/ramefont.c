@@ -0,0 +1,118 @@
+#include "ramefont.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct font_map {
+	struct font_map *next;
+	char *filename;
+	void *base;
+	size_t size;
+	int refs;
+};
+
+static FT_Library library;
+static int library_refs;
+static struct font_map *maps;
+
+FT_Library ramefont_init(void)
+{
+	if (!library_refs && FT_Init_FreeType(&library))
+		return NULL;
+	library_refs++;
+	return library;
+}
+
+void ramefont_done(void)
+{
+	if (library_refs && !--library_refs) {
+		FT_Done_FreeType(library);
+		library = NULL;
+	}
+}
+
+static struct font_map *map_get(const char *filename)
+{
+	struct font_map *m;
+	struct stat st;
+	void *base = MAP_FAILED;
+	int fd;
+
+	for (m = maps; m; m = m->next) {
+		if (!strcmp(m->filename, filename)) {
+			m->refs++;
+			return m;
+		}
+	}
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return NULL;
+
+	m = calloc(1, sizeof(*m));
+	if (m) m->filename = strdup(filename);
+	if (!m || !m->filename) {
+		free(m);
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	m->base = base;
+	m->size = st.st_size;
+	m->refs = 1;
+	m->next = maps;
+	maps = m;
+	return m;
+}
+
+static void map_put(struct font_map *m)
+{
+	struct font_map **p;
+
+	if (--m->refs) return;
+	for (p = &maps; *p != m; p = &(*p)->next)
+		;
+	*p = m->next;
+	munmap(m->base, m->size);
+	free(m->filename);
+	free(m);
+}
+
+FT_Error ramefont_open_face(const char *filename, long face_index, FT_Face *face)
+{
+	struct font_map *m;
+	FT_Error err;
+
+	m = map_get(filename);
+	if (!m) {
+		/* not mappable, let FreeType read the file itself */
+		return FT_New_Face(library, filename, face_index, face);
+	}
+
+	err = FT_New_Memory_Face(library, m->base, m->size, face_index, face);
+	if (err) {
+		map_put(m);
+		return err;
+	}
+	(*face)->generic.data = m;
+	return 0;
+}
+
+/* The mapping is released only after FT_Done_Face has returned: FreeType
+ * still reads the face data in the driver teardown, after the generic
+ * finalizer would have run. */
+void ramefont_done_face(FT_Face face)
+{
+	struct font_map *m;
+
+	if (!face) return;
+	m = face->generic.data;
+	FT_Done_Face(face);
+	if (m) map_put(m);
+}
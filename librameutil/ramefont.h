@@ -0,0 +1,20 @@
+#ifndef RAMEFONT_H
+#define RAMEFONT_H
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/* FreeType library instance shared by all font users in the process.
+ * Reference counted: each ramefont_init() needs a ramefont_done(). */
+FT_Library ramefont_init(void);
+void ramefont_done(void);
+
+/* Open a face from a font file. Each file is mapped to memory once per
+ * process and shared by all faces opened from it (and, being a shared
+ * mapping, by other processes using the same file). Release the face with
+ * ramefont_done_face, not FT_Done_Face; the mapping goes away with the
+ * last face using it. */
+FT_Error ramefont_open_face(const char *filename, long face_index, FT_Face *face);
+void ramefont_done_face(FT_Face face);
+
+#endif
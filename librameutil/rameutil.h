@@ -1,8 +1,7 @@
 #include <EGL/egl.h>
 #include <VG/openvg.h>
 
-#include <ft2build.h>
-#include FT_FREETYPE_H
+#include "ramefont.h"
 
 typedef struct {
 	uint32_t screen_width;
@@ -19,14 +18,59 @@ void fini_egl(state_t *s);
 
 #define LM_SIZE 12
 
+/* loaded_map flags per glyph index */
+#define GLYPH_PATH_LOADED	0x01
+#define GLYPH_ADVANCE_CACHED	0x02
+
+#define CMAP_DENSE_SIZE		256	/* ASCII and Latin-1 */
+#define CMAP_CACHE_SIZE		251
+#define KERN_CACHE_SIZE		509
+#define EXTENT_CACHE_SIZE	8
+
+typedef struct glyph_cmap {
+	wchar_t code;		/* 0 = empty (code 0 is in the dense range) */
+	FT_UInt index;
+} glyph_cmap_t;
+
+typedef struct glyph_kerning {
+	uint64_t key;		/* (prev << 32) | cur, 0 = empty */
+	VGfloat x, y;
+} glyph_kerning_t;
+
+typedef struct text_extent {
+	wchar_t *text;
+	VGfloat w, h;
+} text_extent_t;
+
+/* per-font scratch buffers, grown as needed and reused across calls */
+typedef struct font_scratch {
+	int run_size;		/* glyph run for vgDrawGlyphs */
+	VGuint *glyphs;
+	VGfloat *adjx, *adjy;
+	int segs_size, coords_size;	/* outline decomposition */
+	int n_segs, n_coords;
+	VGubyte *segs;
+	VGfloat *coords;
+} font_scratch_t;
+
 typedef struct fontdata {
 	VGfloat height, ascender, descender;
 	VGFont font;
 	FT_Face face;
+	FT_UInt cmap_dense[CMAP_DENSE_SIZE];
+	glyph_cmap_t cmap_cache[CMAP_CACHE_SIZE];
 	uint8_t *loaded_map[1<<(16-LM_SIZE)];
+	VGfloat *advance_map[1<<(16-LM_SIZE)];
+	glyph_kerning_t kern_cache[KERN_CACHE_SIZE];
+	text_extent_t extent_cache[EXTENT_CACHE_SIZE];
+	font_scratch_t scratch;
+	FT_ULong warmup_char;	/* font_warmup position in the charmap, */
+	FT_UInt warmup_index;	/* index 0 when all glyphs are done */
 } fontdata_t;
 
-fontdata_t *font_load(state_t *s, const char *name, int face_index, unsigned int size);
+fontdata_t *font_load(state_t *s, const char *name, int face_index, unsigned int size, const wchar_t *preload);
 void font_unload(fontdata_t *f);
+void font_preload_range(fontdata_t *f, wchar_t first, wchar_t last);
+int font_warmup(fontdata_t *f, int max_glyphs);
 void font_get_text_extent(fontdata_t *f, const wchar_t *text, VGfloat *w, VGfloat *h);
 void font_draw_text(fontdata_t *f, const wchar_t *text, VGfloat x, VGfloat y, VGbitfield paint_mode);
@@ -1,74 +1,421 @@
+#include <dirent.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
 #include <linux/input.h>
-#include <mosquitto.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#define TOPIC "rame/clock/alert"
+#include "ramebus.h"
 
-static struct mosquitto *mosq;
+#define HIDRAW_DEFAULT_INTERVAL_MS 100
+#define DEFAULT_DEBOUNCE_MS 50
+#define DEFAULT_BROKER "localhost"
+
+#define MAX_DEVICES 16
+#define MAX_KEYS 32
+#define MAX_WATCHES 4
+
+/* event sources in epoll_event.data.u32, devices follow SRC_DEVICE */
+enum { SRC_POLL_TIMER, SRC_BUS, SRC_INOTIFY, SRC_DEVICE };
+
+enum { DEV_INPUT, DEV_HIDRAW };
+
+struct device {
+	int fd;			/* -1 while unplugged */
+	int type;
+	int hotplugged;		/* found in a watched directory, forgotten on removal */
+	char path[PATH_MAX];
+	unsigned int last_code;	/* debouncing */
+	long long last_ms;
+};
+
+/* key code (evdev) or report code (hidraw) to alert state */
+struct key_map {
+	int type;
+	unsigned int code;
+	char state;
+};
+
+static struct ramebus *bus;
 static char state = '0';
 
+static int epfd;
+static int bus_fd = -1;
+static uint32_t bus_events;
+
+static struct device devices[MAX_DEVICES];
+static int num_devices;
+
+static struct key_map keys[MAX_KEYS] = {
+	{ DEV_INPUT, KEY_1, '0' },
+	{ DEV_INPUT, KEY_2, '1' },
+	{ DEV_INPUT, KEY_3, '2' },
+	{ DEV_HIDRAW, 21, '0' },
+	{ DEV_HIDRAW, 22, '2' },
+	{ DEV_HIDRAW, 23, '1' },
+};
+static int num_keys = 6, custom_keys = 0;
+
+static long debounce_ms = DEFAULT_DEBOUNCE_MS;
+
 static void set_state(char new) {
+	struct ramebus_msg msg = { .type = RAMEBUS_MSG_ALERT, .alert = new - '0' };
+
 	state = new;
-	mosquitto_publish(mosq, NULL, TOPIC, 1, &state, 1, true);
+	ramebus_publish(bus, &msg, 1);
+}
+
+/* nothing is subscribed, only publishing */
+static void on_bus_message(struct ramebus *bus, const struct ramebus_msg *msg, void *data) {
+}
+
+/* Maps a press to a state. A press of the same code within debounce_ms
+ * of the previous one on the same device is contact bounce. */
+static void press(struct device *d, unsigned int code) {
+	long long now = ramebus_now_ms();
+	int i;
+
+	if (code == d->last_code && now - d->last_ms < debounce_ms) return;
+	d->last_code = code;
+	d->last_ms = now;
+
+	for (i = 0; i < num_keys; i++) {
+		if (keys[i].type != d->type || keys[i].code != code) continue;
+		/* the polled hidraw buttons repeat while held: only clear
+		 * or raise the alert, never lower it to the steady state */
+		if (d->type == DEV_HIDRAW && keys[i].state != '0' && keys[i].state <= state) return;
+		if (d->type == DEV_HIDRAW && keys[i].state == '0' && state == '0') return;
+		set_state(keys[i].state);
+		return;
+	}
 }
 
 #define REPORT_SIZE 8
-static void handle_hidraw(int dev) {
+/* the device only reports the button after being asked for it */
+static void poll_hidraw(struct device *d) {
 	static const char command[REPORT_SIZE] = {
 		0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02
 	};
-	char report[REPORT_SIZE];
 
-	write(dev, command, REPORT_SIZE);
+	write(d->fd, command, REPORT_SIZE);
+}
 
-	if (read(dev, report, REPORT_SIZE) == REPORT_SIZE)
-		switch (report[0]) {
-		case 21:
-			if (state > '0') set_state('0');
-			break;
-		case 22:
-			if (state < '2') set_state('2');
-			break;
-		case 23:
-			if (state == '0') set_state('1');
-		}
+static void handle_hidraw(struct device *d) {
+	unsigned char report[REPORT_SIZE];
+
+	while (read(d->fd, report, REPORT_SIZE) == REPORT_SIZE)
+		press(d, report[0]);
 }
 
-static void handle_input(int dev) {
+static void handle_input(struct device *d) {
 	struct input_event ev;
 
-	if (read(dev, &ev, sizeof(ev)) == sizeof(ev) && ev.type == EV_KEY && ev.value && ev.code >= KEY_1 && ev.code <= KEY_3)
-		set_state(ev.code - KEY_1 + '0');
+	while (read(d->fd, &ev, sizeof(ev)) == sizeof(ev))
+		if (ev.type == EV_KEY && ev.value == 1)
+			press(d, ev.code);
+}
+
+static void watch_fd(int fd, uint32_t events, uint32_t source) {
+	struct epoll_event ev = { .events = events, .data.u32 = source };
+
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void device_open(struct device *d) {
+	d->fd = open(d->path, (d->type == DEV_HIDRAW ? O_RDWR : O_RDONLY) | O_NONBLOCK | O_CLOEXEC);
+	if (d->fd >= 0)
+		watch_fd(d->fd, EPOLLIN, SRC_DEVICE + (d - devices));
+}
+
+/* closing the fd also removes it from the epoll set */
+static void device_close(struct device *d) {
+	close(d->fd);
+	d->fd = -1;
+	if (d->hotplugged) {
+		*d = devices[--num_devices];
+		if (d->fd >= 0 && d != &devices[num_devices]) {
+			/* moved: re-register under its new index */
+			epoll_ctl(epfd, EPOLL_CTL_DEL, d->fd, NULL);
+			watch_fd(d->fd, EPOLLIN, SRC_DEVICE + (d - devices));
+		}
+	}
+}
+
+static struct device *device_add(int type, const char *path, int hotplugged) {
+	struct device *d;
+	int i;
+
+	for (i = 0; i < num_devices; i++)
+		if (!strcmp(devices[i].path, path))
+			return &devices[i];
+	if (num_devices == MAX_DEVICES) return NULL;
+
+	d = &devices[num_devices++];
+	memset(d, 0, sizeof(*d));
+	d->type = type;
+	d->hotplugged = hotplugged;
+	snprintf(d->path, sizeof(d->path), "%s", path);
+	device_open(d);
+	if (hotplugged && d->fd < 0) {
+		num_devices--;
+		return NULL;
+	}
+	return d;
+}
+
+/* opens the input devices already present in a hotplug directory */
+static void scan_dir(const char *dir) {
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dp;
+
+	if (!(dp = opendir(dir))) return;
+	while ((de = readdir(dp)) != NULL)
+		if (!strncmp(de->d_name, "event", 5)) {
+			snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+			device_add(DEV_INPUT, path, 1);
+		}
+	closedir(dp);
+}
+
+/* New nodes get their final permissions after creation, so both
+ * IN_CREATE and IN_ATTRIB retry opening. Only --watch directories pick
+ * up new devices, the others just see configured devices come back. */
+static void handle_inotify(int fd, char watch_dirs[][PATH_MAX], int *wds, int *hotplug, int num_watches) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	char path[PATH_MAX];
+	ssize_t len;
+	char *p;
+	int i;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *) p;
+			if (!ev->len) continue;
+			for (i = 0; i < num_watches && wds[i] != ev->wd; i++);
+			if (i == num_watches) continue;
+			snprintf(path, sizeof(path), "%s/%s", watch_dirs[i], ev->name);
+			if (hotplug[i] && !strncmp(ev->name, "event", 5))
+				device_add(DEV_INPUT, path, 1);
+
+			/* configured devices that were unplugged */
+			for (i = 0; i < num_devices; i++)
+				if (devices[i].fd < 0 && !strcmp(devices[i].path, path))
+					device_open(&devices[i]);
+		}
+	}
+}
+
+/* Keeps the bus socket in the epoll set with output interest only while
+ * there is queued data. The socket changes on reconnect; a closed socket
+ * leaves the set by itself, so a failed modify means a new one. The
+ * EPOLL* event bits are the poll ones ramebus works with. */
+static void watch_bus(void) {
+	struct epoll_event ev = { .events = ramebus_events(bus), .data.u32 = SRC_BUS };
+	int fd = ramebus_fd(bus);
+
+	if (fd < 0) {
+		bus_fd = -1;
+		return;
+	}
+	if (fd == bus_fd && ev.events == bus_events) return;
+	if (fd != bus_fd || epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno == EEXIST)
+			epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+	bus_fd = fd;
+	bus_events = ev.events;
+}
+
+/* "[hidraw:]CODE=STATE"; the first --map replaces the default keys */
+static int parse_key_map(const char *arg) {
+	struct key_map *k;
+	const char *p = arg;
+	char *end;
+
+	if (!custom_keys) {
+		num_keys = 0;
+		custom_keys = 1;
+	}
+	if (num_keys == MAX_KEYS) return -1;
+	k = &keys[num_keys];
+	k->type = DEV_INPUT;
+	if (!strncmp(p, "hidraw:", 7)) {
+		k->type = DEV_HIDRAW;
+		p += 7;
+	}
+	k->code = strtoul(p, &end, 0);
+	if (end == p || *end != '=' || end[1] < '0' || end[1] > '2' || end[2]) return -1;
+	k->state = end[1];
+	num_keys++;
+	return 0;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr,
+		"usage: %s [options] [hidraw|input DEVICE]...\n"
+		"  -w, --watch DIR       open input devices appearing in DIR (e.g. /dev/input)\n"
+		"  -m, --map [hidraw:]CODE=STATE\n"
+		"                        map a key or report code to state 0-2, repeatable;\n"
+		"                        replaces the default KEY_1..KEY_3 and 21..23 maps\n"
+		"  -d, --debounce MS     ignore repeats of a key within MS (default %d)\n"
+		"  -i, --interval MS     hidraw report polling interval (default %d)\n"
+		"  -b, --broker HOST[:PORT]\n"
+		"                        event bus broker (default %s)\n",
+		name, DEFAULT_DEBOUNCE_MS, HIDRAW_DEFAULT_INTERVAL_MS, DEFAULT_BROKER);
 }
 
 int main(int argc, char **argv) {
-	int dev;
-	void (*handler)(int);
+	int timer = -1, inotify = -1, i, n, opt, type, serviced, hidraw = 0;
+	long interval_ms = HIDRAW_DEFAULT_INTERVAL_MS;
+	const char *broker = DEFAULT_BROKER;
+	struct ramebus_msg will = { .type = RAMEBUS_MSG_ALERT, .alert = RAMEBUS_ALERT_NONE };
+	char watch_dirs[MAX_WATCHES][PATH_MAX], dir[PATH_MAX];
+	int wds[MAX_WATCHES], hotplug[MAX_WATCHES], num_watches = 0;
+	struct epoll_event events[8];
+	struct itimerspec its;
+	struct device *d;
+	uint64_t expirations;
+	static const struct option long_options[] = {
+		{"watch", required_argument, NULL, 'w'},
+		{"map", required_argument, NULL, 'm'},
+		{"debounce", required_argument, NULL, 'd'},
+		{"interval", required_argument, NULL, 'i'},
+		{"broker", required_argument, NULL, 'b'},
+		{NULL, 0, NULL, 0}
+	};
 
-	if (argc < 3) return 1;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) return 1;
 
-	if (!strcmp(argv[1], "hidraw")) handler = handle_hidraw;
-	else if (!strcmp(argv[1], "input")) handler = handle_input;
-	else return 1;
+	while ((opt = getopt_long(argc, argv, "w:m:d:i:b:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'w':
+			if (num_watches < MAX_WATCHES) {
+				hotplug[num_watches] = 1;
+				snprintf(watch_dirs[num_watches++], PATH_MAX, "%s", optarg);
+			}
+			break;
+		case 'm':
+			if (parse_key_map(optarg)) {
+				fprintf(stderr, "invalid key map: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'd':
+			debounce_ms = atol(optarg);
+			break;
+		case 'i':
+			interval_ms = atol(optarg);
+			break;
+		case 'b':
+			broker = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
-	dev = open(argv[2], O_RDWR);
-	if (dev == -1) return 1;
+	/* device pairs */
+	for (i = optind; i < argc; i++) {
+		if (!strcmp(argv[i], "hidraw")) type = DEV_HIDRAW;
+		else if (!strcmp(argv[i], "input")) type = DEV_INPUT;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+		if (++i == argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		hidraw |= type == DEV_HIDRAW;
+		if (!(d = device_add(type, argv[i], 0))) return 1;
+		/* reopen on replug */
+		if (num_watches < MAX_WATCHES) {
+			hotplug[num_watches] = 0;
+			snprintf(dir, sizeof(dir), "%s", argv[i]);
+			snprintf(watch_dirs[num_watches++], PATH_MAX, "%s", dirname(dir));
+		}
+	}
+	if (!num_devices && !num_watches) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (interval_ms <= 0) interval_ms = HIDRAW_DEFAULT_INTERVAL_MS;
 
-	fcntl(dev, F_SETFL, fcntl(dev, F_GETFL, 0) | O_NONBLOCK);
+	if (num_watches) {
+		inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotify == -1) return 1;
+		for (i = 0; i < num_watches; i++) {
+			wds[i] = inotify_add_watch(inotify, watch_dirs[i], IN_CREATE | IN_ATTRIB);
+			if (hotplug[i]) scan_dir(watch_dirs[i]);
+		}
+		watch_fd(inotify, EPOLLIN, SRC_INOTIFY);
+	}
 
-	mosquitto_lib_init();
-	mosq = mosquitto_new(NULL, true, NULL);
-	mosquitto_will_set(mosq, TOPIC, 1, &state, 1, true);
-	mosquitto_connect(mosq, "localhost", 1883, 60);
+	if (hidraw) {
+		timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timer == -1) return 1;
+		its.it_interval.tv_sec = interval_ms / 1000;
+		its.it_interval.tv_nsec = interval_ms % 1000 * 1000000;
+		its.it_value = its.it_interval;
+		timerfd_settime(timer, 0, &its, NULL);
+		watch_fd(timer, EPOLLIN, SRC_POLL_TIMER);
+	}
+
+	bus = ramebus_new(on_bus_message, NULL);
+	ramebus_set_will(bus, &will, 1);
+	ramebus_connect(bus, broker);
 
 	set_state(state);
 
 	while (1) {
-		handler(dev);
-		mosquitto_loop(mosq, 100, 1);
+		watch_bus();
+		n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), ramebus_timeout(bus));
+		if (n < 0 && errno != EINTR) return 1;
+
+		serviced = 0;
+		for (i = 0; i < n; i++) {
+			switch (events[i].data.u32) {
+			case SRC_POLL_TIMER:
+				if (read(timer, &expirations, sizeof(expirations)) == sizeof(expirations))
+					for (d = devices; d < devices + num_devices; d++)
+						if (d->fd >= 0 && d->type == DEV_HIDRAW)
+							poll_hidraw(d);
+				break;
+			case SRC_BUS:
+				ramebus_service(bus, events[i].events);
+				serviced = 1;
+				break;
+			case SRC_INOTIFY:
+				handle_inotify(inotify, watch_dirs, wds, hotplug, num_watches);
+				break;
+			default:
+				d = &devices[events[i].data.u32 - SRC_DEVICE];
+				/* a device closed earlier in this batch */
+				if (d >= devices + num_devices || d->fd < 0) break;
+				errno = 0;
+				if (d->type == DEV_HIDRAW) handle_hidraw(d);
+				else handle_input(d);
+				/* unplugged */
+				if (events[i].events & (EPOLLERR | EPOLLHUP) || errno == ENODEV)
+					device_close(d);
+				break;
+			}
+		}
+		/* keepalive and reconnect also while the socket is quiet */
+		if (!serviced) ramebus_service(bus, 0);
 	}
 }
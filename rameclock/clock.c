@@ -1,14 +1,21 @@
 #include "rameutil.h"
+#include "ramebus.h"
 
 #include <time.h>
 #include <assert.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <errno.h>
 #include <wchar.h>
-#include <mosquitto.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "VG/openvg.h"
 #include "VG/vgu.h"
@@ -95,6 +102,25 @@ static VGPath create_tick(VGfloat a, VGfloat b, VGfloat w)
 	return create_rect(-w/2, a, w, b-a);
 }
 
+/* one path holding a tick at every step'th of the 60 positions, skipping
+ * positions that are multiples of skip (drawn by a bigger tick) */
+static VGPath create_ticks(VGfloat a, VGfloat b, VGfloat w, int step, int skip)
+{
+	VGPath tick = create_tick(a, b, w);
+	VGPath path = vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_F, 1.0f, 0.0f, 0, 0, VG_PATH_CAPABILITY_ALL);
+	int i;
+
+	for (i = 0; i < 60; i += step) {
+		if (skip && i % skip == 0) continue;
+		vgLoadIdentity();
+		vgRotate(360/60.0 * i);
+		vgTransformPath(path, tick);
+	}
+	vgLoadIdentity();
+	vgDestroyPath(tick);
+	return path;
+}
+
 static const VGfloat rgba_white[4]  = { 1.0, 1.0, 1.0, 1.0 };
 static const VGfloat rgba_red[4]    = { 1.0,   0,   0, 1.0 };
 static const VGfloat rgba_black[4]  = {   0,   0,   0, 1.0 };
@@ -102,166 +128,794 @@ static const VGfloat rgba_silver[4] = { 0.3, 0.3, 0.3, 1.0 };
 
 static const VGfloat rgba_alert[2][4] = {{1.0, 1.0, 0, 0.4}, {1.0, 0, 0, 0.4}};
 
-static VGImage load_ppm(const char *filename, int *logo_w, int *logo_h)
+/* Netpbm header parsing on the mapped file. Whitespace and '#' comments
+ * may appear between the fields of P5/P6 headers. */
+static int pnm_next_uint(const unsigned char **p, const unsigned char *end, unsigned int *val)
 {
-	FILE *fp = NULL;
-	char *buf = NULL;
-	VGImage image = VG_INVALID_HANDLE;
-	unsigned int w, h, d;
-	int r;
-
-	fp = fopen(filename, "rb");
-	if (!fp) goto err;
+	const unsigned char *s = *p;
+
+	while (s < end) {
+		if (*s == '#') {
+			while (s < end && *s != '\n') s++;
+		} else if (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r') {
+			s++;
+		} else break;
+	}
+	if (s >= end || *s < '0' || *s > '9') return -1;
+	for (*val = 0; s < end && *s >= '0' && *s <= '9'; s++)
+		*val = *val * 10 + (*s - '0');
+	*p = s;
+	return 0;
+}
 
-	if (fscanf(fp, "P6\n%u %u\n%u\n", &w, &h, &d) != 3) goto err;
-	if (d != 255) goto err;
+/* PAM (P7) header: "KEY value" lines up to ENDHDR */
+static int pam_parse_header(const unsigned char **p, const unsigned char *end,
+			    unsigned int *w, unsigned int *h, unsigned int *depth,
+			    unsigned int *maxval, int *premultiplied)
+{
+	const unsigned char *s = *p, *eol;
+	char line[80];
+	size_t len;
+
+	*w = *h = *depth = *maxval = 0;
+	*premultiplied = 0;
+	while (s < end) {
+		for (eol = s; eol < end && *eol != '\n'; eol++);
+		len = eol - s;
+		if (len >= sizeof(line)) len = sizeof(line) - 1;
+		memcpy(line, s, len);
+		line[len] = 0;
+		s = eol < end ? eol + 1 : end;
+
+		if (!strcmp(line, "ENDHDR")) {
+			*p = s;
+			return (*w && *h && *depth) ? 0 : -1;
+		}
+		sscanf(line, "WIDTH %u", w);
+		sscanf(line, "HEIGHT %u", h);
+		sscanf(line, "DEPTH %u", depth);
+		sscanf(line, "MAXVAL %u", maxval);
+		if (!strcmp(line, "TUPLTYPE RGB_ALPHA_PREMULTIPLIED"))
+			*premultiplied = 1;
+	}
+	return -1;
+}
 
-	buf = malloc(w*h*4);
-	if (!buf) goto err;
+/* Expands packed RGB to RGBA with opaque alpha, i.e. VG_sABGR_8888 in
+ * little endian memory order. Four pixels are moved per step as three
+ * 32-bit loads and four stores. */
+static void rgb_to_rgba(uint32_t *dst, const unsigned char *src, size_t pixels)
+{
+	const uint32_t a = 0xff000000;
+	uint32_t w0, w1, w2;
+
+	for (; pixels >= 4; pixels -= 4, src += 12, dst += 4) {
+		memcpy(&w0, src, 4);
+		memcpy(&w1, src + 4, 4);
+		memcpy(&w2, src + 8, 4);
+		dst[0] = w0 | a;
+		dst[1] = (w0 >> 24) | (w1 << 8) | a;
+		dst[2] = (w1 >> 16) | (w2 << 16) | a;
+		dst[3] = (w2 >> 8) | a;
+	}
+	for (; pixels; pixels--, src += 3, dst++)
+		*dst = src[0] | (src[1] << 8) | (src[2] << 16) | a;
+}
 
-	for (r = 0; r < w*h*4; r += 4) {
-		buf[r+0] = fgetc(fp);
-		buf[r+1] = fgetc(fp);
-		buf[r+2] = fgetc(fp);
-		buf[r+3] = 0xff;
+/* Loads a binary Netpbm image: P5 (grayscale), P6 (RGB) or P7 with DEPTH
+ * 1, 3 or 4; a P7 TUPLTYPE of RGB_ALPHA_PREMULTIPLIED selects premultiplied
+ * alpha. Only maxval 255 is supported. The file is mapped and rows are
+ * uploaded bottom up straight from the mapping where the format allows. */
+static VGImage load_image(const char *filename, int *logo_w, int *logo_h)
+{
+	VGImage image = VG_INVALID_HANDLE;
+	const unsigned char *map = MAP_FAILED, *p, *end;
+	unsigned char *buf = NULL;
+	unsigned int w, h, depth, maxval;
+	int fd, premultiplied = 0;
+	struct stat st;
+	size_t stride;
+	VGImageFormat format;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return VG_INVALID_HANDLE;
+	if (fstat(fd, &st) < 0 || st.st_size < 3) goto err;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) goto err;
+
+	p = map + 2;
+	end = map + st.st_size;
+	if (map[0] != 'P') goto err;
+	switch (map[1]) {
+	case '5':
+	case '6':
+		depth = map[1] == '5' ? 1 : 3;
+		if (pnm_next_uint(&p, end, &w) || pnm_next_uint(&p, end, &h) ||
+		    pnm_next_uint(&p, end, &maxval))
+			goto err;
+		/* exactly one whitespace character before the raster */
+		p++;
+		break;
+	case '7':
+		if (p >= end || *p++ != '\n') goto err;
+		if (pam_parse_header(&p, end, &w, &h, &depth, &maxval, &premultiplied)) goto err;
+		break;
+	default:
+		goto err;
+	}
+	if (maxval != 255 || !w || !h) goto err;
+	if (depth != 1 && depth != 3 && depth != 4) goto err;
+	if (p > end || (size_t)(end - p) / depth / w < h) goto err;
+
+	switch (depth) {
+	case 1:
+		format = VG_sL_8;
+		stride = w;
+		break;
+	case 3:
+		/* VG has no packed 24-bit format, expand to RGBA */
+		stride = w * 4;
+		buf = malloc(stride * h);
+		if (!buf) goto err;
+		rgb_to_rgba((uint32_t *) buf, p, (size_t) w * h);
+		p = buf;
+		format = VG_sABGR_8888;
+		break;
+	default:
+		stride = w * 4;
+		format = premultiplied ? VG_sABGR_8888_PRE : VG_sABGR_8888;
+		/* 32-bit pixel data must be 4-byte aligned for upload */
+		if ((uintptr_t) p & 3) {
+			buf = malloc(stride * h);
+			if (!buf) goto err;
+			memcpy(buf, p, stride * h);
+			p = buf;
+		}
+		break;
 	}
 
-	image = vgCreateImage(VG_sABGR_8888, w, h, VG_IMAGE_QUALITY_BETTER);
-	vgImageSubData(image, buf+w*4*(h-1), -w*4, VG_sABGR_8888, 0, 0, w, h);
+	image = vgCreateImage(format, w, h, VG_IMAGE_QUALITY_BETTER);
+	if (image != VG_INVALID_HANDLE)
+		vgImageSubData(image, p + stride * (h-1), -(VGint) stride, format, 0, 0, w, h);
 	*logo_w = w;
 	*logo_h = h;
 
 err:
-	if (fp) fclose(fp);
 	free(buf);
+	if (map != MAP_FAILED) munmap((void *) map, st.st_size);
+	close(fd);
 	return image;
 }
 
-#define TIME_BUF_SIZE 13
+/* the longest stopwatch time, 2562047 hours (the int64_t nanosecond
+ * range) with hundredths: "2562047:59:59.99" */
+#define TIME_BUF_SIZE 24
 
 #define MODE_CLOCK     0
 #define MODE_STOPWATCH 1
 
-static char stopwatch_reset_flag = 0;
-static time_t stopwatch_start_time = 0;
+#define MAX_CLOCKS 16
+#define MAX_FONTS 3	/* cells share a size, so one font per digital style */
+#define WARMUP_GLYPHS_PER_FRAME 8	/* glyphs loaded in the idle time after a swap */
+
+/* Time zone offsets are cached and refreshed on UTC quarter hours. Zones
+ * only change their offset on quarter hour boundaries, so the cached
+ * offset is never stale. */
+#define TZ_REFRESH_INTERVAL (15 * 60)
+
+#define NSEC_PER_SEC 1000000000LL
+#define STOPWATCH_LAP_HOLD_NS (5 * NSEC_PER_SEC)
+
+/* The stopwatch runs on CLOCK_MONOTONIC so wall clock adjustments do not
+ * affect it. It is shared by all stopwatch clocks and controlled with
+ * start, stop, lap and reset commands, see stopwatch_command(). */
+static struct stopwatch {
+	int running;
+	int digits;		/* 0 whole seconds, 1 tenths, 2 hundredths */
+	int64_t start_ns;	/* when running, elapsed_ns was reached here */
+	int64_t elapsed_ns;
+	int64_t lap_ns;		/* split time shown until lap_until_ns */
+	int64_t lap_until_ns;
+	unsigned int generation;	/* bumped by commands to redraw */
+} stopwatch = { .running = 1 };
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int64_t stopwatch_elapsed(int64_t now)
+{
+	return stopwatch.elapsed_ns + (stopwatch.running ? now - stopwatch.start_ns : 0);
+}
+
+static void stopwatch_command(int cmd)
+{
+	int64_t now = monotonic_ns();
+
+	switch (cmd) {
+	case RAMEBUS_STOPWATCH_START:
+		if (!stopwatch.running) {
+			stopwatch.start_ns = now;
+			stopwatch.running = 1;
+		}
+		break;
+	case RAMEBUS_STOPWATCH_STOP:
+		if (stopwatch.running) {
+			stopwatch.elapsed_ns += now - stopwatch.start_ns;
+			stopwatch.running = 0;
+		}
+		break;
+	case RAMEBUS_STOPWATCH_LAP:
+		stopwatch.lap_ns = stopwatch_elapsed(now);
+		stopwatch.lap_until_ns = now + STOPWATCH_LAP_HOLD_NS;
+		break;
+	case RAMEBUS_STOPWATCH_RESET:
+		stopwatch.elapsed_ns = 0;
+		stopwatch.start_ns = now;
+		stopwatch.lap_until_ns = 0;
+		break;
+	default:
+		return;
+	}
+	stopwatch.generation++;
+}
+
+/* Nanoseconds from monotonic time now until the displayed stopwatch value
+ * changes, or 0 if it does not change by itself. */
+static int64_t stopwatch_next_change(int64_t now)
+{
+	int64_t unit = NSEC_PER_SEC, elapsed;
+	int i;
+
+	if (now < stopwatch.lap_until_ns)
+		return stopwatch.lap_until_ns - now;
+	if (!stopwatch.running)
+		return 0;
+	for (i = 0; i < stopwatch.digits; i++)
+		unit /= 10;
+	elapsed = stopwatch_elapsed(now);
+	return unit - elapsed % unit;
+}
+
+struct clock_cell {
+	int analog, digital;
+	char mode;
+	const char *tz;		/* NULL for the local time zone */
+	long gmtoff;
+	time_t gmtoff_expires;
+
+	/* layout in screen coordinates */
+	VGfloat x, y, w, h;
+	VGfloat analog_h, analog_size;
+	VGfloat normalized[9];	/* unit circle to the analog face */
+	fontdata_t *font;
+	VGfloat digital_h;
 
-static void update_time(struct timeval *tv, struct tm *tm, wchar_t *buf, char mode) {
-	gettimeofday(tv, 0);
-	localtime_r(&tv->tv_sec, tm);
+	struct tm tm;
+	wchar_t time_buf[TIME_BUF_SIZE];
+};
+
+/* Applies "[analog|digital|combined][:clock|:stopwatch][@zone]" on top of
+ * the defaults already in c; modifies spec. */
+static int parse_clock_spec(struct clock_cell *c, char *spec)
+{
+	char *zone, *mode;
+
+	if ((zone = strchr(spec, '@')) != NULL) {
+		*zone++ = 0;
+		c->tz = zone;
+	}
+	if ((mode = strchr(spec, ':')) != NULL) {
+		*mode++ = 0;
+		if (!strcmp(mode, "stopwatch")) c->mode = MODE_STOPWATCH;
+		else if (!strcmp(mode, "clock")) c->mode = MODE_CLOCK;
+		else return -1;
+	}
+	if (!*spec) return 0;
+	if (!strcmp(spec, "analog")) {
+		c->analog = 1;
+		c->digital = 0;
+	} else if (!strcmp(spec, "combined")) {
+		c->analog = 1;
+		c->digital = 1;
+	} else if (!strcmp(spec, "digital")) {
+		c->analog = 0;
+		c->digital = 1;
+	} else return -1;
+	return 0;
+}
+
+/* UTC offset of zone tz at time t; switches TZ temporarily */
+static long tz_gmtoff(const char *tz, time_t t)
+{
+	char *saved = getenv("TZ");
+	struct tm tm;
+
+	if (saved) saved = strdup(saved);
+	setenv("TZ", tz, 1);
+	tzset();
+	localtime_r(&t, &tm);
+	if (saved) {
+		setenv("TZ", saved, 1);
+		free(saved);
+	} else unsetenv("TZ");
+	tzset();
+	return tm.tm_gmtoff;
+}
+
+/* fills tm and time_buf for the time in tv, which is the time the frame is
+ * shown at rather than the time it is rendered; mono_ns is the same
+ * instant on CLOCK_MONOTONIC */
+static void update_time(struct clock_cell *c, const struct timeval *tv, int64_t mono_ns) {
+	struct tm *tm = &c->tm;
+	wchar_t *buf = c->time_buf;
+	time_t t = tv->tv_sec;
+
+	if (c->tz) {
+		/* also refresh if the wall clock was set back */
+		if (t >= c->gmtoff_expires || t < c->gmtoff_expires - TZ_REFRESH_INTERVAL) {
+			c->gmtoff = tz_gmtoff(c->tz, t);
+			c->gmtoff_expires = t - t % TZ_REFRESH_INTERVAL + TZ_REFRESH_INTERVAL;
+		}
+		t += c->gmtoff;
+		gmtime_r(&t, tm);
+	} else {
+		localtime_r(&t, tm);
+	}
 
 	//tm->tm_hour = 7;
 	//tm->tm_min = 20;
 
-	if (mode == MODE_STOPWATCH)
+	if (c->mode == MODE_STOPWATCH)
 	{
-		if (stopwatch_start_time == 0 ||
-		    stopwatch_reset_flag)
-		{
-			stopwatch_start_time = tv->tv_sec;
-			stopwatch_reset_flag = 0;
-		}
-		long sw_sec = (long)(tv->tv_sec - stopwatch_start_time);
+		int64_t sw_ns = mono_ns < stopwatch.lap_until_ns ? stopwatch.lap_ns : stopwatch_elapsed(mono_ns);
+		long sw_sec = (long)(sw_ns / NSEC_PER_SEC);
 		int seconds = (int)(sw_sec % 60);
 		int minutes = (int)((sw_sec / 60) % 60);
 		int hours = (int)(sw_sec / 3600);
+		int frac = (int)(sw_ns % NSEC_PER_SEC / (stopwatch.digits == 1 ? 100000000 : 10000000));
+		int n;
 		if (hours > 0) {
-			swprintf(buf, TIME_BUF_SIZE - 1, L"%d:%02d:%02d", hours, minutes, seconds);
+			n = swprintf(buf, TIME_BUF_SIZE, L"%d:%02d:%02d", hours, minutes, seconds);
 		} else {
-			swprintf(buf, TIME_BUF_SIZE - 1, L"%02d:%02d", minutes, seconds);
+			n = swprintf(buf, TIME_BUF_SIZE, L"%02d:%02d", minutes, seconds);
 		}
+		if (n < 0) {
+			buf[0] = L'\0';
+			return;
+		}
+		/* a fraction that does not fit is left out */
+		if (stopwatch.digits &&
+		    swprintf(buf + n, TIME_BUF_SIZE - n, L".%0*d", stopwatch.digits, frac) < 0)
+			buf[n] = L'\0';
 	} else {
 		wcsftime(buf, TIME_BUF_SIZE, L"%T", tm);
 	}
 }
 
-static void on_connect(struct mosquitto *mosq, void *data, int status) {
-	if (!status) mosquitto_subscribe(mosq, NULL, "rame/clock/alert", 1);
+/* fonts of the digital displays, shared by cells of the same size */
+static struct {
+	unsigned int size;
+	fontdata_t *font;
+} fonts[MAX_FONTS];
+static int num_fonts = 0;
+
+static fontdata_t *get_font(state_t *s, unsigned int size)
+{
+	int i;
+
+	for (i = 0; i < num_fonts; i++)
+		if (fonts[i].size == size)
+			return fonts[i].font;
+	assert(num_fonts < MAX_FONTS);
+	fonts[num_fonts].size = size;
+	fonts[num_fonts].font = font_load(s, "ramefbcp", 0, size, L"0123456789:.");
+	return fonts[num_fonts++].font;
 }
 
-static void on_message(struct mosquitto *mosq, void *data, const struct mosquitto_message *msg)
+/* Loads up to max_glyphs more glyphs of the digital fonts beyond the
+ * preloaded digits, so that a later text does not stall a frame on glyph
+ * loading. Returns nonzero while some are left. */
+static int warmup_fonts(int max_glyphs)
 {
-	if (msg->payloadlen)
-	{
-		memcpy(data, msg->payload, 1);
-		if (*(char *)data == '0')
-			stopwatch_reset_flag = 1;
+	int i, left = 0;
+
+	for (i = 0; i < num_fonts; i++)
+		if (fonts[i].font)
+			left |= font_warmup(fonts[i].font, max_glyphs);
+	return left;
+}
+
+/* Places clock c into the screen rectangle x, y, w, h. The digital time
+ * goes on top and the analog face takes the space it leaves. */
+static void layout_cell(state_t *s, struct clock_cell *c, VGfloat x, VGfloat y, VGfloat w, VGfloat h)
+{
+	unsigned int size;
+	VGfloat digital_w;
+
+	c->x = x;
+	c->y = y;
+	c->w = w;
+	c->h = h;
+	c->digital_h = 0;
+
+	if (c->digital) {
+		if (c->analog)
+			size = w > h ? h / 4 : w / 5;
+		else
+		{
+			if (c->mode == MODE_STOPWATCH)
+				/* fractions take as much width as minutes */
+				size = (w > h ? h * 2 / 5 : w * 2 / 7) * 5 / (stopwatch.digits ? 6 + stopwatch.digits : 5);
+			else
+				size = w > h ? h / 3 : w / 4;
+		}
+		c->font = get_font(s, size);
+		font_get_text_extent(c->font, c->time_buf, &digital_w, &c->digital_h);
+	}
+
+	if (c->analog) {
+		c->analog_h = h - c->digital_h;
+		if (c->analog_h < w) c->analog_size = c->analog_h;
+		else {
+			c->analog_size = w;
+			if (c->digital)
+				c->analog_h = (c->analog_h * 2 + c->analog_size) / 3;
+		}
+
+		/* standard translation (center of the cell's analog area) */
+		vgLoadIdentity();
+		vgTranslate(x + w / 2.0, y + c->analog_h / 2.0);
+		vgScale(c->analog_size / 2.0, c->analog_size / 2.0);
+		vgGetMatrix(c->normalized);
+		vgLoadIdentity();
+	}
+}
+
+/* Frames are rendered ahead of the wall clock instant they show and
+ * swapped right at it, so the timer fires this much before the target.
+ * This is the default frame time budget, see --budget. */
+#define FRAME_LEAD_US 20000
+
+#define SWEEP_DEFAULT_FPS 30
+
+/* Computes the next wall clock instant at which the rendered content for
+ * time tv changes: the next second, or the next half second while the
+ * blinking alert is shown. With a sweeping second hand (sweep_fps != 0)
+ * frames are also due sweep_fps times a second, in slots rounded up to
+ * whole microseconds so that the last one is the second itself, and a
+ * running stopwatch changes stopwatch_us after tv. */
+static void next_frame_time(const struct timeval *tv, char alert_state, long sweep_fps, long stopwatch_us, struct timespec *target)
+{
+	long usec = 1000000, next;
+
+	if (alert_state == '2' && tv->tv_usec < 500000)
+		usec = 500000;
+	if (sweep_fps) {
+		next = tv->tv_usec * sweep_fps / 1000000 + 1;
+		next = (next * 1000000 + sweep_fps - 1) / sweep_fps;
+		if (next < usec) usec = next;
+	}
+	if (stopwatch_us > 0 && tv->tv_usec + stopwatch_us < usec)
+		usec = tv->tv_usec + stopwatch_us;
+	target->tv_sec = tv->tv_sec + usec / 1000000;
+	target->tv_nsec = (usec % 1000000) * 1000;
+}
+
+/* Arms the frame timer lead_us before target. The timer is cancelled if
+ * the wall clock is set, so a time step re-renders right away. */
+static void schedule_frame(int timer_fd, const struct timespec *target, long lead_us)
+{
+	struct itimerspec its = { { 0, 0 }, *target };
+
+	its.it_value.tv_nsec -= lead_us * 1000;
+	while (its.it_value.tv_nsec < 0) {
+		its.it_value.tv_nsec += 1000000000;
+		its.it_value.tv_sec--;
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+}
+
+#define JITTER_REPORT_FRAMES 60
+
+/* difference between swap completion and the frame's target time */
+struct jitter_stats {
+	int frames, late;
+	long min_us, max_us;
+	long long sum_us;
+};
+
+static void jitter_add(struct jitter_stats *js, const struct timespec *target, int late)
+{
+	struct timespec now;
+	long us;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	us = (now.tv_sec - target->tv_sec) * 1000000L + (now.tv_nsec - target->tv_nsec) / 1000;
+	if (!js->frames || us < js->min_us) js->min_us = us;
+	if (!js->frames || us > js->max_us) js->max_us = us;
+	js->sum_us += us;
+	js->late += late;
+
+	if (++js->frames == JITTER_REPORT_FRAMES) {
+		fprintf(stderr, "swap jitter: min %ld avg %lld max %ld us, %d of %d frames rendered late\n",
+			js->min_us, js->sum_us / js->frames, js->max_us, js->late, js->frames);
+		memset(js, 0, sizeof(*js));
+	}
+}
+
+/* per-phase frame timing, enabled with --timing */
+enum { PHASE_CLEAR, PHASE_LOGO, PHASE_FACE, PHASE_HANDS, PHASE_DIGITAL, PHASE_SWAP, NUM_PHASES };
+
+static const char *phase_names[NUM_PHASES] = { "clear", "logo", "face", "hands", "digital", "swap" };
+
+#define PHASE_HIST_BUCKET_US 100
+#define PHASE_HIST_BUCKETS 500	/* last bucket collects everything above 50 ms */
+
+struct phase_stats {
+	int count;
+	long min_us, max_us;
+	long long sum_us;
+	unsigned int hist[PHASE_HIST_BUCKETS];
+};
+
+#define HUD_LINE_SIZE 64
+/* everything the overlay draws: phase names and their figures */
+#define HUD_GLYPHS L"0123456789./- acdefghilmnoprstw"
+
+/* Waits for the GPU to finish the phase's commands so the time spent is
+ * attributed to it, adds the time since *start and restarts *start. */
+static void phase_end(struct phase_stats *ps, struct timespec *start)
+{
+	struct timespec now;
+	long us;
+	int bucket;
+
+	vgFinish();
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+	*start = now;
+
+	if (!ps->count || us < ps->min_us) ps->min_us = us;
+	if (!ps->count || us > ps->max_us) ps->max_us = us;
+	ps->sum_us += us;
+	ps->count++;
+	bucket = us / PHASE_HIST_BUCKET_US;
+	if (bucket >= PHASE_HIST_BUCKETS) bucket = PHASE_HIST_BUCKETS - 1;
+	ps->hist[bucket]++;
+}
+
+/* upper bound of the bucket holding the 99th percentile */
+static long phase_p99(const struct phase_stats *ps)
+{
+	int i, n = 0, limit = ps->count - ps->count / 100;
+
+	for (i = 0; i < PHASE_HIST_BUCKETS - 1; i++) {
+		n += ps->hist[i];
+		if (n >= limit) break;
+	}
+	return (i + 1) * PHASE_HIST_BUCKET_US;
+}
+
+/* logs and resets the statistics, keeping a summary line per phase in hud */
+static void phase_report(struct phase_stats *stats, wchar_t hud[NUM_PHASES][HUD_LINE_SIZE])
+{
+	struct phase_stats *ps;
+	int i;
+
+	fprintf(stderr, "frame timing (us):\n");
+	for (i = 0; i < NUM_PHASES; i++) {
+		ps = &stats[i];
+		if (!ps->count) {
+			swprintf(hud[i], HUD_LINE_SIZE, L"%s -", phase_names[i]);
+			continue;
+		}
+		fprintf(stderr, "  %-8s n %4d  min %6ld  avg %6lld  p99 <%6ld  max %6ld\n",
+			phase_names[i], ps->count, ps->min_us, ps->sum_us / ps->count,
+			phase_p99(ps), ps->max_us);
+		swprintf(hud[i], HUD_LINE_SIZE, L"%s %.1f/%.1f ms", phase_names[i],
+			 ps->sum_us / ps->count / 1000.0, phase_p99(ps) / 1000.0);
+		memset(ps, 0, sizeof(*ps));
+	}
+}
+
+static void on_bus_message(struct ramebus *bus, const struct ramebus_msg *msg, void *data)
+{
+	char *alert_state = data;
+
+	switch (msg->type) {
+	case RAMEBUS_MSG_ALERT:
+		*alert_state = '0' + msg->alert;
+		/* clearing the alert also resets the stopwatch */
+		if (msg->alert == RAMEBUS_ALERT_NONE)
+			stopwatch_command(RAMEBUS_STOPWATCH_RESET);
+		break;
+	case RAMEBUS_MSG_STOPWATCH:
+		stopwatch_command(msg->stopwatch);
+		break;
+	case RAMEBUS_MSG_CONNECTION:
+		/* a stale alert is not shown while the broker is away */
+		if (!msg->connected)
+			*alert_state = '0';
+		break;
+	default:
+		break;
 	}
 }
 
 int main(int argc, char **argv)
 {
-	float fps = 25.0;
 	state_t state = {0}, *s = &state;
 	struct timeval tv;
-	struct tm tm;
+	struct timespec real_now;
+	int64_t mono;
 	int i;
 
 	VGPath background_rect;
 	VGPaint black_paint, gradient_paint;
 
-	int analog = 1;
-	VGfloat analog_h, analog_size;
+	int analog = 0;
 	int logo_w, logo_h;
 	VGImage logo = VG_INVALID_HANDLE;
-	VGPath mega_tick, big_tick, small_tick, hour_hand, minute_hand, second_hand;
+	VGPath mega_ticks, big_ticks, small_ticks, hour_hand, minute_hand, second_hand;
 	VGPaint red_paint, silver_paint;
 
-	int digital = 0;
-	fontdata_t *font;
-	wchar_t time_buf[TIME_BUF_SIZE] = { 0 };
-	VGfloat digital_w;
-	VGfloat digital_h = 0;
+	struct clock_cell defaults = { .analog = 1, .mode = MODE_CLOCK };
+	struct clock_cell cells[MAX_CLOCKS], *c;
+	char *clock_specs[MAX_CLOCKS];
+	int num_clocks = 0, columns = 0, rows, stopwatches = 0;
+	VGfloat cell_w, cell_h, logo_scale;
+	VGfloat digital_w, digital_h;
 
-	struct mosquitto *mosq = NULL;
-	time_t last_reconn_attempt = 0;
-	char alert_state = '0';
-	char mode = MODE_CLOCK;
+	struct ramebus *bus = NULL;
+	char alert_state = '0', shown_alert_state;
+	unsigned int shown_stopwatch_generation;
 	VGPaint alert_paint[2];
 
+	/* background, logo, alert overlay and clock faces only change with the
+	 * alert overlay, so they are rendered once and blitted after. A single
+	 * full screen image is kept and rendered again when the overlay
+	 * changes, GPU memory is too scarce for one per variant. */
+	VGImage static_layer = VG_INVALID_HANDLE;
+	int static_layer_variant = -1;	/* the layer value it holds */
+	int static_layer_failed = 0;	/* out of image memory, draw every frame */
+	int layer;
+
+	int timer_fd;
+	struct pollfd pfd[2];
+	uint64_t expirations;
+	struct timespec target, now;
+	int on_schedule = 0, late;
+	int timing = 0;
+	int sweep = 0;
+	float fps = SWEEP_DEFAULT_FPS;
+	long sweep_fps = 0, frame_us = 0, frame_lead_us = FRAME_LEAD_US;
+	VGfloat seconds;
+	struct jitter_stats jitter = {0};
+	struct phase_stats phases[NUM_PHASES];
+	struct timespec phase_start;
+	int hud = 0, frames = 0;
+	int warmup = 0;
+	fontdata_t *hud_font = NULL;
+	wchar_t hud_text[NUM_PHASES][HUD_LINE_SIZE];
+
 	int opt;
 	static const struct option long_options[] = {
 		{"broker", required_argument, NULL, 'b'},
 		{"display", required_argument, NULL, 'd'},
 		{"logo", required_argument, NULL, 'l'},
 		{"mode", required_argument, NULL, 'm'},
+		{"timing", no_argument, NULL, 't'},
+		{"sweep", no_argument, NULL, 's'},
+		{"fps", required_argument, NULL, 'f'},
+		{"budget", required_argument, NULL, 'B'},
+		{"hud", no_argument, NULL, 'H'},
+		{"clock", required_argument, NULL, 'c'},
+		{"columns", required_argument, NULL, 'C'},
+		{"precision", required_argument, NULL, 'p'},
+		{"warmup", no_argument, NULL, 'w'},
 		{NULL, 0, NULL, 0}
 	};
 
 	bcm_host_init();
 	init_egl(s);
 
-	while ((opt = getopt_long(argc, argv, "b:d:l:m:", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "b:d:l:m:tsf:B:Hc:C:p:w", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'b':
 			for (i = 0; i < 2; i++)
 				alert_paint[i] = create_paint(rgba_alert[i]);
 
-			mosquitto_lib_init();
-			mosq = mosquitto_new(NULL, true, &alert_state);
-			mosquitto_connect_callback_set(mosq, on_connect);
-			mosquitto_message_callback_set(mosq, on_message);
-			mosquitto_connect(mosq, optarg, 1883, 60);
+			bus = ramebus_new(on_bus_message, &alert_state);
+			ramebus_subscribe(bus, RAMEBUS_TOPIC_ALERT);
+			ramebus_subscribe(bus, RAMEBUS_TOPIC_STOPWATCH);
+			ramebus_connect(bus, optarg);
 
 			break;
 		case 'd':
-			if (!strcmp(optarg, "combined")) digital = 1;
+			if (!strcmp(optarg, "combined")) defaults.digital = 1;
 			else if (!strcmp(optarg, "digital")) {
-				analog = 0;
-				digital = 1;
+				defaults.analog = 0;
+				defaults.digital = 1;
 			}
 			break;
 		case 'l':
-			logo = load_ppm(optarg, &logo_w, &logo_h);
+			logo = load_image(optarg, &logo_w, &logo_h);
 			break;
 		case 'm':
 			/* Note: clock is implicit default mode */
 			if (!strcmp(optarg, "stopwatch")) {
-				mode = MODE_STOPWATCH;
+				defaults.mode = MODE_STOPWATCH;
 			}
 			break;
+		case 't':
+			timing = 1;
+			break;
+		case 's':
+			sweep = 1;
+			break;
+		case 'f':
+			fps = atof(optarg);
+			break;
+		case 'B':
+			/* milliseconds from timer wakeup to the swap */
+			frame_lead_us = atof(optarg) * 1000;
+			break;
+		case 'H':
+			/* the overlay shows the --timing statistics */
+			hud = timing = 1;
+			break;
+		case 'c':
+			if (num_clocks < MAX_CLOCKS)
+				clock_specs[num_clocks++] = optarg;
+			break;
+		case 'C':
+			columns = atoi(optarg);
+			break;
+		case 'p':
+			/* stopwatch resolution */
+			if (!strcmp(optarg, "tenths")) stopwatch.digits = 1;
+			else if (!strcmp(optarg, "hundredths")) stopwatch.digits = 2;
+			else stopwatch.digits = 0;
+			break;
+		case 'w':
+			/* convert the rest of the digital fonts between frames */
+			warmup = 1;
+			break;
+		}
+	}
+
+	/* --display and --mode are the defaults for each --clock, and
+	 * describe the only clock when none is given */
+	if (!num_clocks)
+		clock_specs[num_clocks++] = "";
+	for (i = 0; i < num_clocks; i++) {
+		cells[i] = defaults;
+		if (parse_clock_spec(&cells[i], clock_specs[i])) {
+			fprintf(stderr, "invalid clock: %s\n", clock_specs[i]);
+			return 1;
 		}
+		analog |= cells[i].analog;
+		stopwatches |= cells[i].mode == MODE_STOPWATCH;
 	}
 
+	if (sweep && analog && fps > 0) {
+		/* whole frames per second, so the frames line up with the seconds */
+		sweep_fps = fps + 0.5f;
+		if (sweep_fps < 1) sweep_fps = 1;
+		if (sweep_fps > 1000) sweep_fps = 1000;
+		frame_us = 1000000 / sweep_fps;
+	}
+	/* the budget can not exceed the frame period it is taken from */
+	if (frame_us && frame_lead_us > frame_us)
+		frame_lead_us = frame_us;
+	if (frame_lead_us < 0)
+		frame_lead_us = 0;
+
 	// set up screen ratio
 	glViewport(0, 0, (GLsizei) s->screen_width, (GLsizei) s->screen_height);
 
@@ -275,45 +929,38 @@ int main(int argc, char **argv)
 	black_paint = create_paint(rgba_black);
 	background_rect = create_rect(0, 0, s->screen_width, s->screen_height);
 
-	if (digital) {
-		unsigned int size;
-		if (analog)
-			size = ratio > 1 ? s->screen_height / 4 : s->screen_width / 5;
-		else
-		{
-			if (mode == MODE_STOPWATCH)
-				size = ratio > 1 ? s->screen_height * 2 / 5 : s->screen_width * 2 / 7;
-			else
-				size = ratio > 1 ? s->screen_height / 3 : s->screen_width / 4;
-		}
-		font = font_load(s, "ramefbcp", 0, size);
-		update_time(&tv, &tm, time_buf, mode);
-		font_get_text_extent(font, time_buf, &digital_w, &digital_h);
+	/* grid layout, filled row by row from the top left */
+	if (columns <= 0)
+		for (columns = 1; columns * columns < num_clocks; columns++);
+	if (columns > num_clocks)
+		columns = num_clocks;
+	rows = (num_clocks + columns - 1) / columns;
+	cell_w = (VGfloat) s->screen_width / columns;
+	cell_h = (VGfloat) s->screen_height / rows;
+	/* the logo keeps its full screen size relative to the cell */
+	logo_scale = 0.3 * (cell_w / s->screen_width < cell_h / s->screen_height ?
+			    cell_w / s->screen_width : cell_h / s->screen_height);
+
+	gettimeofday(&tv, 0);
+	stopwatch.start_ns = mono = monotonic_ns();
+	for (i = 0; i < num_clocks; i++) {
+		update_time(&cells[i], &tv, mono);
+		layout_cell(s, &cells[i], (i % columns) * cell_w,
+			    s->screen_height - (i / columns + 1) * cell_h, cell_w, cell_h);
 	}
 
 	if (analog) {
-		analog_h = s->screen_height - digital_h;
-		if (analog_h < s->screen_width) analog_size = analog_h;
-		else {
-			analog_size = s->screen_width;
-			if (digital)
-				analog_h = (analog_h * 2 + analog_size) / 3;
-		}
-
-		/* create standard translation (center screen) */
-		vgTranslate(s->screen_width / 2.0, analog_h / 2.0);
-		vgScale(analog_size / 2.0, analog_size / 2.0);
-		vgGetMatrix(s->normalized_screen);
-
 		vgSeti(VG_STROKE_CAP_STYLE, VG_CAP_BUTT);
 		vgSeti(VG_STROKE_JOIN_STYLE, VG_JOIN_MITER);
 
 		silver_paint = create_paint(rgba_silver);
 		red_paint = create_paint(rgba_red);
 
-		mega_tick = create_tick(.71, .91, 0.04);
-		big_tick = create_tick(.8, .9, 0.04);
-		small_tick = create_tick(.825, .875, 0.01);
+		/* the face and hand paths are in unit circle coordinates and
+		 * shared by all clocks through their normalized matrix */
+		mega_ticks = create_ticks(.71, .91, 0.04, 15, 0);
+		big_ticks = create_ticks(.8, .9, 0.04, 5, 15);
+		small_ticks = create_ticks(.825, .875, 0.01, 1, 5);
 
 		hour_hand = create_big_hand(0.5);
 		minute_hand = create_big_hand(0.9);
@@ -322,89 +969,195 @@ int main(int argc, char **argv)
 		assert(vgGetError() == VG_NO_ERROR);
 	}
 
-	while (1) {
-		update_time(&tv, &tm, time_buf, mode);
-
-		if (mosq && mosquitto_loop(mosq, 0, 1) && tv.tv_sec - last_reconn_attempt > 5) {
-			alert_state = '0';
-			mosquitto_reconnect_async(mosq);
-			last_reconn_attempt = tv.tv_sec;
-		}
-
-		/* clear */
-		vgLoadIdentity();
-		vgSetPaint(gradient_paint, VG_FILL_PATH);
-		vgDrawPath(background_rect, VG_STROKE_PATH | VG_FILL_PATH);
+	if (timing) {
+		memset(phases, 0, sizeof(phases));
+		for (i = 0; i < NUM_PHASES; i++)
+			swprintf(hud_text[i], HUD_LINE_SIZE, L"%s -", phase_names[i]);
+	}
+	if (hud)
+		hud_font = font_load(s, "ramefbcp", 0, s->screen_height / 40, HUD_GLYPHS);
 
-		/* logo */
-		if (analog && logo != VG_INVALID_HANDLE) {
-			vgSeti(VG_MATRIX_MODE, VG_MATRIX_IMAGE_USER_TO_SURFACE);
-			vgLoadIdentity();
-			vgTranslate(s->screen_width / 2, analog_h / 2 - analog_size / 4);
-			vgScale(0.3, 0.3);
-			vgTranslate(-logo_w/2, -logo_h/2);
-			vgDrawImage(logo);
-			vgSeti(VG_MATRIX_MODE, VG_MATRIX_PATH_USER_TO_SURFACE);
-		}
+	timer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+	assert(timer_fd >= 0);
 
-		if (alert_state == '1' || (alert_state == '2' && tv.tv_usec >= 500000)) {
+	while (1) {
+		/* the frame's show time tv on the monotonic clock */
+		clock_gettime(CLOCK_REALTIME, &real_now);
+		mono = monotonic_ns() + (tv.tv_sec - real_now.tv_sec) * NSEC_PER_SEC +
+		       (tv.tv_usec * 1000LL - real_now.tv_nsec);
+		for (i = 0; i < num_clocks; i++)
+			update_time(&cells[i], &tv, mono);
+		shown_alert_state = alert_state;
+		shown_stopwatch_generation = stopwatch.generation;
+
+		if (timing) clock_gettime(CLOCK_MONOTONIC, &phase_start);
+
+		layer = 0;
+		if (alert_state == '1' || (alert_state == '2' && tv.tv_usec >= 500000))
+			layer = alert_state - '0';
+
+		if (static_layer != VG_INVALID_HANDLE && static_layer_variant == layer) {
+			vgSetPixels(0, 0, static_layer, 0, 0, s->screen_width, s->screen_height);
+			if (timing) phase_end(&phases[PHASE_CLEAR], &phase_start);
+		} else {
+			/* clear */
 			vgLoadIdentity();
-			vgSetPaint(alert_paint[alert_state - '1'], VG_FILL_PATH);
+			vgSetPaint(gradient_paint, VG_FILL_PATH);
 			vgDrawPath(background_rect, VG_STROKE_PATH | VG_FILL_PATH);
-		}
-
-		if (analog) {
-			/* clock face */
-			vgLoadMatrix(s->normalized_screen);
-			vgSetPaint(black_paint, VG_FILL_PATH);
-			//vgSetPaint(black_paint, VG_STROKE_PATH);
-			vgSetPaint(silver_paint, VG_STROKE_PATH);
-			vgSetf(VG_STROKE_LINE_WIDTH, 0.008);
-			for (i = 0; i < 60; i++) {
-				if (i % 15 == 0) {
-					vgDrawPath(mega_tick, VG_FILL_PATH | VG_STROKE_PATH);
-				} else if (i % 5 == 0) {
-					vgDrawPath(big_tick, VG_FILL_PATH);
-				} else {
-					vgDrawPath(small_tick, VG_FILL_PATH);
+			if (timing) phase_end(&phases[PHASE_CLEAR], &phase_start);
+
+			/* logo */
+			if (analog && logo != VG_INVALID_HANDLE) {
+				vgSeti(VG_MATRIX_MODE, VG_MATRIX_IMAGE_USER_TO_SURFACE);
+				for (c = cells; c < cells + num_clocks; c++) {
+					if (!c->analog) continue;
+					vgLoadIdentity();
+					vgTranslate(c->x + c->w / 2, c->y + c->analog_h / 2 - c->analog_size / 4);
+					vgScale(logo_scale, logo_scale);
+					vgTranslate(-logo_w/2, -logo_h/2);
+					vgDrawImage(logo);
 				}
-				vgRotate(360/60.0);
+				vgSeti(VG_MATRIX_MODE, VG_MATRIX_PATH_USER_TO_SURFACE);
+				if (timing) phase_end(&phases[PHASE_LOGO], &phase_start);
 			}
 
-			vgSetf(VG_STROKE_LINE_WIDTH, 0.008);
-			vgSetPaint(silver_paint, VG_STROKE_PATH);
-			vgSetPaint(black_paint, VG_FILL_PATH);
+			if (layer) {
+				vgLoadIdentity();
+				vgSetPaint(alert_paint[layer - 1], VG_FILL_PATH);
+				vgDrawPath(background_rect, VG_STROKE_PATH | VG_FILL_PATH);
+			}
 
-			vgLoadMatrix(s->normalized_screen);
-			vgRotate(-360.0/12.0 * (tm.tm_min/60.0 + tm.tm_hour));
-			vgDrawPath(hour_hand, VG_STROKE_PATH | VG_FILL_PATH);
+			if (analog) {
+				/* clock faces */
+				vgSetPaint(black_paint, VG_FILL_PATH);
+				vgSetPaint(silver_paint, VG_STROKE_PATH);
+				vgSetf(VG_STROKE_LINE_WIDTH, 0.008);
+				for (c = cells; c < cells + num_clocks; c++) {
+					if (!c->analog) continue;
+					vgLoadMatrix(c->normalized);
+					vgDrawPath(mega_ticks, VG_FILL_PATH | VG_STROKE_PATH);
+					vgDrawPath(big_ticks, VG_FILL_PATH);
+					vgDrawPath(small_ticks, VG_FILL_PATH);
+				}
+			}
 
-			vgLoadMatrix(s->normalized_screen);
-			vgRotate(-360.0/60.0 * (tm.tm_sec/60.0 + tm.tm_min));
-			vgDrawPath(minute_hand, VG_STROKE_PATH | VG_FILL_PATH);
+			if (static_layer == VG_INVALID_HANDLE && !static_layer_failed) {
+				static_layer = vgCreateImage(VG_sRGBA_8888, s->screen_width, s->screen_height, VG_IMAGE_QUALITY_NONANTIALIASED);
+				if (static_layer == VG_INVALID_HANDLE) {
+					/* consume the error, so that it does not trip the
+					 * frame check below, and stop further attempts */
+					vgGetError();
+					static_layer_failed = 1;
+				}
+			}
+			if (static_layer != VG_INVALID_HANDLE) {
+				vgGetPixels(static_layer, 0, 0, 0, 0, s->screen_width, s->screen_height);
+				static_layer_variant = layer;
+			}
+			if (timing) phase_end(&phases[PHASE_FACE], &phase_start);
+		}
+
+		if (analog) {
+			for (c = cells; c < cells + num_clocks; c++) {
+				if (!c->analog) continue;
+
+				vgSetf(VG_STROKE_LINE_WIDTH, 0.008);
+				vgSetPaint(silver_paint, VG_STROKE_PATH);
+				vgSetPaint(black_paint, VG_FILL_PATH);
+
+				vgLoadMatrix(c->normalized);
+				vgRotate(-360.0/12.0 * (c->tm.tm_min/60.0 + c->tm.tm_hour));
+				vgDrawPath(hour_hand, VG_STROKE_PATH | VG_FILL_PATH);
+
+				vgLoadMatrix(c->normalized);
+				seconds = c->tm.tm_sec;
+				if (frame_us) seconds += tv.tv_usec / 1000000.0;
+				vgRotate(-360.0/60.0 * (seconds/60.0 + c->tm.tm_min));
+				vgDrawPath(minute_hand, VG_STROKE_PATH | VG_FILL_PATH);
+
+				vgSetPaint(red_paint, VG_STROKE_PATH);
+				vgSetPaint(red_paint, VG_FILL_PATH);
+				vgSetf(VG_STROKE_LINE_WIDTH, 0.01);
+				vgLoadMatrix(c->normalized);
+				vgRotate(-360.0/60.0 * seconds);
+				vgDrawPath(second_hand, VG_STROKE_PATH | VG_FILL_PATH);
+			}
+			if (timing) phase_end(&phases[PHASE_HANDS], &phase_start);
+		}
 
-			vgSetPaint(red_paint, VG_STROKE_PATH);
-			vgSetPaint(red_paint, VG_FILL_PATH);
-			vgSetf(VG_STROKE_LINE_WIDTH, 0.01);
-			vgLoadMatrix(s->normalized_screen);
-			vgRotate(-360.0/60.0 * tm.tm_sec);
-			vgDrawPath(second_hand, VG_STROKE_PATH | VG_FILL_PATH);
+		vgSetPaint(black_paint, VG_FILL_PATH);
+		for (c = cells; c < cells + num_clocks; c++) {
+			if (!c->digital) continue;
+			font_get_text_extent(c->font, c->time_buf, &digital_w, &digital_h);
+			font_draw_text(c->font, c->time_buf, c->x + (c->w - digital_w) / 2.0,
+				       c->y + (c->analog ? c->analog_h : (c->h - digital_h) / 2.0), VG_FILL_PATH);
 		}
+		if (timing) phase_end(&phases[PHASE_DIGITAL], &phase_start);
 
-		if (digital) {
+		if (hud) {
 			vgSetPaint(black_paint, VG_FILL_PATH);
-			font_get_text_extent(font, time_buf, &digital_w, &digital_h);
-			font_draw_text(font, time_buf, (s->screen_width - digital_w) / 2.0, analog ? analog_h : (s->screen_height - digital_h) / 2.0, VG_FILL_PATH);
+			for (i = 0; i < NUM_PHASES; i++)
+				font_draw_text(hud_font, hud_text[i], hud_font->height / 2,
+					       s->screen_height - (i + 1.5) * hud_font->height, VG_FILL_PATH);
 		}
 
 		assert(vgGetError() == VG_NO_ERROR);
+
+		/* hold the finished frame until the instant it shows */
+		if (on_schedule) {
+			clock_gettime(CLOCK_REALTIME, &now);
+			late = now.tv_sec > target.tv_sec ||
+			       (now.tv_sec == target.tv_sec && now.tv_nsec > target.tv_nsec);
+			if (!late)
+				while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &target, NULL) == EINTR);
+		}
+		if (timing) clock_gettime(CLOCK_MONOTONIC, &phase_start);
 		eglSwapBuffers(s->display, s->surface);
 		assert(eglGetError() == EGL_SUCCESS);
+		if (timing) {
+			phase_end(&phases[PHASE_SWAP], &phase_start);
+			if (on_schedule)
+				jitter_add(&jitter, &target, late);
+			if (++frames % JITTER_REPORT_FRAMES == 0)
+				phase_report(phases, hud_text);
+		}
 
-		usleep(1000000/fps);
-		//usleep(50 * 1000);
+		/* the frame is out, glyph loading here delays nothing shown */
+		if (warmup)
+			warmup = warmup_fonts(WARMUP_GLYPHS_PER_FRAME);
+
+		/* sleep until the content changes: either the timer reaches the
+		 * next visible change or an MQTT message changes the alert */
+		next_frame_time(&tv, shown_alert_state, sweep_fps,
+				stopwatches ? (stopwatch_next_change(mono) + 999) / 1000 : 0, &target);
+		schedule_frame(timer_fd, &target, frame_lead_us);
+		on_schedule = 0;
+		while (1) {
+			pfd[0].fd = timer_fd;
+			pfd[0].events = POLLIN;
+			pfd[1].fd = bus ? ramebus_fd(bus) : -1;
+			pfd[1].events = bus ? ramebus_events(bus) : 0;
+			pfd[1].revents = 0;
+			if (poll(pfd, 2, bus ? ramebus_timeout(bus) : -1) < 0) continue;
+
+			if (bus)
+				ramebus_service(bus, pfd[1].revents);
+			if (pfd[0].revents & POLLIN) {
+				/* ECANCELED: the wall clock was set, show it now */
+				if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno == ECANCELED)
+					break;
+				tv.tv_sec = target.tv_sec;
+				tv.tv_usec = target.tv_nsec / 1000;
+				on_schedule = 1;
+				break;
+			}
+			if (alert_state != shown_alert_state || stopwatch.generation != shown_stopwatch_generation) break;
+		}
+		if (!on_schedule)
+			gettimeofday(&tv, 0);
 	}
 
+	ramebus_free(bus);
 	fini_egl(s);
 	return 0;
 }
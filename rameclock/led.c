@@ -1,52 +1,151 @@
 #include <fcntl.h>
-#include <mosquitto.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "ramebus.h"
+
 #define NUM_LEDS 3
+#define NUM_STATES 3
+
+#define LED_PATH "/sys/class/leds/rame:ext%d/%s"
+
+#define DEFAULT_BLINK_PERIOD_MS 1000
+#define DEFAULT_BROKER "localhost"
+#define COALESCE_MS 50	/* alert changes within this are written as one */
+
+enum { LED_OFF, LED_ON, LED_BLINK, LED_UNKNOWN };
 
 static int fd[NUM_LEDS];
+static int led_mode[NUM_LEDS] = { LED_UNKNOWN, LED_UNKNOWN, LED_UNKNOWN };
+
+/* LED mode used for the lit LED of each alert state, see --blink */
+static int state_mode[NUM_STATES] = { LED_ON, LED_ON, LED_ON };
+static long blink_period_ms = DEFAULT_BLINK_PERIOD_MS;
+
+static int pending = -2;	/* selection waiting to be applied, -2 for none */
+static int coalesce_fd = -1;	/* one-shot timer applying pending */
 
-static void on_connect(struct mosquitto *mosq, void *data, int status) {
-	if (!status) mosquitto_subscribe(mosq, NULL, "rame/clock/alert", 1);
+static int write_attr(int led, const char *attr, const char *value) {
+	char path[64];
+	int afd, r;
+
+	snprintf(path, sizeof(path), LED_PATH, led + 1, attr);
+	afd = open(path, O_WRONLY);
+	if (afd == -1) return -1;
+	r = write(afd, value, strlen(value));
+	close(afd);
+	return r < 0 ? -1 : 0;
 }
 
-static void select_led(int index) {
+/* Moves one LED to mode, touching sysfs only on a change. Blinking is
+ * left to the kernel timer trigger; switching the trigger back to none
+ * turns the LED off, so brightness is written after it. */
+static void set_led(int i, int mode) {
 	static const char *values[] = {"0", "255"};
-	const char *value;
-	int i;
+	char delay[24];
 
-	for (i = 0; i < NUM_LEDS; i++) {
-		value = values[i == index];
-		write(fd[i], value, strlen(value));
+	if (led_mode[i] == mode) return;
+
+	if (mode == LED_BLINK) {
+		snprintf(delay, sizeof(delay), "%ld", blink_period_ms / 2);
+		write_attr(i, "trigger", "timer");
+		write_attr(i, "delay_on", delay);
+		write_attr(i, "delay_off", delay);
+	} else {
+		if (led_mode[i] == LED_BLINK || led_mode[i] == LED_UNKNOWN)
+			write_attr(i, "trigger", "none");
+		write(fd[i], values[mode], strlen(values[mode]));
 	}
+	led_mode[i] = mode;
+}
+
+static void select_led(int index) {
+	int i;
+
+	for (i = 0; i < NUM_LEDS; i++)
+		set_led(i, i == index ? state_mode[index % NUM_STATES] : LED_OFF);
 }
 
-static void on_message(struct mosquitto *mosq, void *data, const struct mosquitto_message *msg) {
-	if (msg->payloadlen) select_led(*((unsigned char *) msg->payload) - '0');
+static void on_bus_message(struct ramebus *bus, const struct ramebus_msg *msg, void *data) {
+	struct itimerspec its = { .it_value.tv_nsec = COALESCE_MS * 1000000L };
+
+	if (msg->type != RAMEBUS_MSG_ALERT) return;
+	/* only the last state of a burst is written, when the timer that the
+	 * first one armed fires, so sysfs sees at most one update per period */
+	if (pending == -2)
+		timerfd_settime(coalesce_fd, 0, &its, NULL);
+	pending = msg->alert;
 }
 
 #define BUF_SIZE 64
-int main() {
-	struct mosquitto *mosq;
+int main(int argc, char **argv) {
+	struct ramebus *bus;
+	struct pollfd pfd[2];
+	uint64_t expirations;
+	const char *broker = DEFAULT_BROKER;
 
-	int i;
+	int i, opt;
 	char buf[BUF_SIZE];
+	static const struct option long_options[] = {
+		{"blink", required_argument, NULL, 'b'},
+		{"period", required_argument, NULL, 'p'},
+		{"broker", required_argument, NULL, 'B'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "b:p:B:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'b':
+			/* alert state whose LED blinks instead of staying lit */
+			i = atoi(optarg);
+			if (i >= 0 && i < NUM_STATES) state_mode[i] = LED_BLINK;
+			break;
+		case 'p':
+			blink_period_ms = atol(optarg);
+			if (blink_period_ms < 2) blink_period_ms = DEFAULT_BLINK_PERIOD_MS;
+			break;
+		case 'B':
+			broker = optarg;
+			break;
+		}
+	}
 
 	for (i = 0; i < NUM_LEDS; i++) {
-		snprintf(buf, BUF_SIZE, "/sys/class/leds/rame:ext%d/brightness", i + 1);
+		snprintf(buf, BUF_SIZE, LED_PATH, i + 1, "brightness");
 		fd[i] = open(buf, O_WRONLY);
 		if (fd[i] == -1) return 1;
 	}
 	select_led(-1);
 
-	mosquitto_lib_init();
-	mosq = mosquitto_new(NULL, true, NULL);
-	mosquitto_connect_callback_set(mosq, on_connect);
-	mosquitto_message_callback_set(mosq, on_message);
-	mosquitto_connect(mosq, "localhost", 1883, 60);
-	mosquitto_loop_forever(mosq, -1, 1);
+	coalesce_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (coalesce_fd == -1) return 1;
+
+	bus = ramebus_new(on_bus_message, NULL);
+	ramebus_subscribe(bus, RAMEBUS_TOPIC_ALERT);
+	ramebus_connect(bus, broker);
+
+	while (1) {
+		pfd[0].fd = ramebus_fd(bus);
+		pfd[0].events = ramebus_events(bus);
+		pfd[1].fd = coalesce_fd;
+		pfd[1].events = POLLIN;
+		pfd[0].revents = pfd[1].revents = 0;
+		if (poll(pfd, 2, ramebus_timeout(bus)) < 0) continue;
+
+		ramebus_service(bus, pfd[0].revents);
+		if ((pfd[1].revents & POLLIN) &&
+		    read(coalesce_fd, &expirations, sizeof(expirations)) == sizeof(expirations) &&
+		    pending != -2) {
+			select_led(pending);
+			pending = -2;
+		}
+	}
 }
@@ -21,9 +21,10 @@ static const int infodisplay_progress_bar_height = 2;
 
 static const int animation_cycle_length_ms = 1000;
 
-static const float scroll_speed_pix_per_s = 20.0f;
+static const float scroll_speed_pix_per_s = 20.0f; // default row speed
 static const float scroll_startpoint_delay_s = 1.0f;
 static const float scroll_endpoint_delay_s = 2.0f;
+static const int scroll_marquee_gap_rows = 2; // marquee gap in row heights
 
 
 static int mini(int a, int b)
@@ -41,35 +42,100 @@ static float minf(float a, float b)
     return a < b ? a : b;
 }
 
-static float maxf(float a, float b)
-{
-    return a > b ? a : b;
-}
 
-static float clampf(float value, float min_val, float max_val)
+// keeps the earliest of the scheduled changes, -1 = none
+static void schedule_change(int *next_ms, int ms)
 {
-    return maxf(min_val, minf(value, max_val));
+    if (*next_ms < 0 || ms < *next_ms)
+        *next_ms = ms;
 }
 
-static float stepf(float value, float step_pos)
+
+static void scroll_restart(INFODISPLAY_SCROLL *sc)
 {
-    return value < step_pos ? 0.0f : 1.0f;
+    sc->pos = 0;
+    sc->dir = 1;
+    sc->hold_s = -1; // start delay, set on first step
 }
 
-static float boxstepf(float value, float slope_start, float slope_end)
+// Time a page stays shown, long enough to read it at the row speed.
+static float scroll_page_hold(const INFODISPLAY_SCROLL *sc, float speed, int range, int page)
 {
-    float diff = slope_end - slope_start;
-    if (diff == 0)
-        return stepf(value, slope_start);
-    return clampf((value - slope_start) / diff, 0.0f, 1.0f);
+    float hold_s = page / speed;
+    if (sc->pos <= 0)
+        hold_s += scroll_startpoint_delay_s;
+    if (sc->pos >= range)
+        hold_s += scroll_endpoint_delay_s;
+    return hold_s;
 }
 
-static float boxpulsef(float value,
-                       float up_slope_start, float up_slope_end,
-                       float down_slope_start, float down_slope_end)
+// Advances row scrolling by frame time dt_s. range is the scroll length in
+// pixels: the overflowing part of the text, or text and gap for marquee.
+// page is the visible width. Returns seconds until the drawn offset changes.
+static float scroll_step(INFODISPLAY_SCROLL *sc, float dt_s, int range, int page)
 {
-    return boxstepf(value,   up_slope_start,   up_slope_end)
-         - boxstepf(value, down_slope_start, down_slope_end);
+    const float speed = sc->speed > 0 ? sc->speed : scroll_speed_pix_per_s;
+
+    // text or icon space may have changed since the previous step
+    if (sc->mode == INFODISPLAY_SCROLL_MARQUEE)
+        sc->pos = fmodf(sc->pos, range);
+    else if (sc->pos > range)
+        sc->pos = range;
+    if (sc->hold_s < 0)
+        sc->hold_s = sc->mode == INFODISPLAY_SCROLL_PAGE ?
+            scroll_page_hold(sc, speed, range, page) : scroll_startpoint_delay_s;
+
+    while (dt_s > 0)
+    {
+        if (sc->hold_s > 0)
+        {
+            if (dt_s < sc->hold_s)
+            {
+                sc->hold_s -= dt_s;
+                break;
+            }
+            dt_s -= sc->hold_s;
+            sc->hold_s = 0;
+            if (sc->mode == INFODISPLAY_SCROLL_PAGE)
+            {
+                // flip, the last page is aligned to the end of the text
+                sc->pos = sc->pos >= range ? 0 : minf(sc->pos + page, range);
+                sc->hold_s = scroll_page_hold(sc, speed, range, page);
+            }
+            continue;
+        }
+
+        if (sc->mode == INFODISPLAY_SCROLL_MARQUEE)
+        {
+            sc->pos = fmodf(sc->pos + speed * dt_s, range);
+            break;
+        }
+
+        // pingpong: move towards the current end and pause there
+        float target = sc->dir > 0 ? range : 0;
+        float move_s = fabsf(target - sc->pos) / speed;
+        if (dt_s < move_s)
+        {
+            sc->pos += sc->dir * speed * dt_s;
+            break;
+        }
+        dt_s -= move_s;
+        sc->pos = target;
+        sc->hold_s = sc->dir > 0 ? scroll_endpoint_delay_s : scroll_startpoint_delay_s;
+        sc->dir = -sc->dir;
+    }
+
+    if (sc->hold_s > 0)
+    {
+        // flips and backwards moves change the offset right away,
+        // forwards moves after the first whole pixel
+        if (sc->mode == INFODISPLAY_SCROLL_PAGE || sc->dir < 0)
+            return sc->hold_s;
+        return sc->hold_s + 1.0f / speed;
+    }
+    if (sc->dir < 0)
+        return (sc->pos - floorf(sc->pos)) / speed;
+    return (floorf(sc->pos) + 1.0f - sc->pos) / speed;
 }
 
 
@@ -402,10 +468,17 @@ static int get_text_size(INFODISPLAY *disp, const char *text,
 }
 */
 
+// Width of the blank gap after the text in the row text surfaces, which
+// makes each surface a ring the marquee scroll can wrap around.
+static int marquee_gap(const INFODISPLAY *disp)
+{
+    return disp->row_height * scroll_marquee_gap_rows;
+}
+
 static void draw_text_to_row_textsurf(INFODISPLAY *disp, int info_row,
                                       const char *text)
 {
-    int width, height, size_res;
+    int width, height, size_res, surf_width;
 
     if (disp == NULL)
         return; // error
@@ -429,18 +502,21 @@ static void draw_text_to_row_textsurf(INFODISPLAY *disp, int info_row,
         return; // error
     }
 
+    // text followed by the (cleared) marquee gap
+    surf_width = width + marquee_gap(disp);
+
     if (disp->info_row_textsurf[info_row] == NULL ||
-        disp->info_row_textsurf[info_row]->w < width ||
+        disp->info_row_textsurf[info_row]->w < surf_width ||
         disp->info_row_textsurf[info_row]->h < height)
     {
         // reallocate larger work area, using max width&height of earlier and new
         if (disp->info_row_textsurf[info_row] != NULL)
         {
-            width = maxi(disp->info_row_textsurf[info_row]->w, width);
+            surf_width = maxi(disp->info_row_textsurf[info_row]->w, surf_width);
             height = maxi(disp->info_row_textsurf[info_row]->h, height);
         }
         TTF_FreeSurface(disp->info_row_textsurf[info_row]);
-        disp->info_row_textsurf[info_row] = TTF_CreateSurface(width, height);
+        disp->info_row_textsurf[info_row] = TTF_CreateSurface(surf_width, height);
     }
     else
         TTF_ClearSurface(disp->info_row_textsurf[info_row]);
@@ -470,26 +546,31 @@ static void draw_text_to_row_textsurf(INFODISPLAY *disp, int info_row,
     TTF_RenderUTF8_Shaded_Surface(disp->info_row_textsurf[info_row], disp->font, text);
 }
 
+// Blits columns [src_x, src_x + src_width[ of the row text surface to dx,dy.
 static void blit_row_textsurf(INFODISPLAY *disp, int info_row, int dx, int dy,
+                              int src_x, int src_width,
                               int clip_top_left_x, int clip_top_left_y,
                               int clip_width, int clip_height)
 {
     if (disp == NULL || disp->info_row_textsurf[info_row] == NULL)
         return; // error
     TTF_Surface *surf = disp->info_row_textsurf[info_row];
-    int width = surf->w, height = surf->h;
+    if (src_x < 0 || src_x >= surf->w)
+        return;
+    const unsigned char *src = (const unsigned char *)surf->pixels + src_x;
+    int width = mini(src_width, surf->w - src_x), height = surf->h;
     if ((disp->info_row_bkg_color[info_row] & 0xffffff) == 0)
-        blit_8_or(disp,                                      // target & clip rect:
+        blit_8_or(disp,                                // target & clip rect:
                   clip_top_left_x, clip_top_left_y, clip_width, clip_height,
-                  dx, dy,                                    // target pos
-                  surf->pixels, width, height, surf->pitch,  // src data, size and pitch
-                  disp->info_row_color[info_row]);           // tint color
+                  dx, dy,                              // target pos
+                  src, width, height, surf->pitch,     // src data, size and pitch
+                  disp->info_row_color[info_row]);     // tint color
     else
-        blit_8_blend(disp,                                      // target & clip rect:
+        blit_8_blend(disp,                                // target & clip rect:
                      clip_top_left_x, clip_top_left_y, clip_width, clip_height,
-                     dx, dy,                                    // target pos
-                     surf->pixels, width, height, surf->pitch,  // src data, size and pitch
-                     disp->info_row_color[info_row]);           // tint color
+                     dx, dy,                              // target pos
+                     src, width, height, surf->pitch,     // src data, size and pitch
+                     disp->info_row_color[info_row]);     // tint color
 }
 
 
@@ -564,6 +645,7 @@ INFODISPLAY * infodisplay_create(int width, int height,
         // the rest is set here
         disp->info_row_color[a] = 0xffffffff;
         disp->info_row_bkg_color[a] = 0xff000000;
+        scroll_restart(&disp->info_row_scroll[a]);
     }
 
     if (ttf_filename != NULL)
@@ -623,6 +705,22 @@ void infodisplay_close(INFODISPLAY *disp)
 }
 
 
+// adds a fallback font for characters missing from the main font,
+// loaded only when such a character is first drawn. returns 0 on success.
+int infodisplay_add_fallback_font(INFODISPLAY *disp, const char *ttf_filename)
+{
+    if (disp == NULL || disp->font == NULL)
+        return -1;
+    if (TTF_AddFallbackFont(disp->font, ttf_filename) < 0)
+    {
+        fprintf(stderr, "Couldn't add fallback font %s: %s\n",
+                ttf_filename, TTF_GetError());
+        return -1;
+    }
+    return 0;
+}
+
+
 // progress=[0..1], color=aarrggbb (32bits)
 void infodisplay_set_progress(INFODISPLAY *disp, int row, float progress, unsigned long color)
 {
@@ -675,7 +773,7 @@ void infodisplay_set_row_text(INFODISPLAY *disp, int row, int type, const char *
         // note: if realloc failed, earlier mem block is still used (if any)
     }
 
-    disp->info_row_scroll_time_s[row] = 0;
+    scroll_restart(&disp->info_row_scroll[row]);
     disp->info_row_last_update[row] = 0;
 
     if (disp->info_row_mem[row])
@@ -707,6 +805,24 @@ void infodisplay_set_row_icon(INFODISPLAY *disp, int row, INFODISPLAY_ICON icon)
     disp->info_row_icon[row] = icon;
 }
 
+// row=[0..INFODISPLAY_ROW_COUNT[, speed in pixels per second (<=0 for default),
+// restarts the row scrolling from the beginning
+void infodisplay_set_row_scroll(INFODISPLAY *disp, int row, INFODISPLAY_SCROLL_MODE mode, float speed)
+{
+    if (row < 0 || row >= INFODISPLAY_ROW_COUNT)
+    {
+        #ifdef DEBUG_SUPPORT
+        dbg_printf("infodisplay_set_row_scroll: Invalid row number %d\n", row);
+        #endif
+        return;
+    }
+    if (mode < 0 || mode >= INFODISPLAY_SCROLL_MODE_COUNT)
+        mode = INFODISPLAY_SCROLL_PINGPONG;
+    disp->info_row_scroll[row].mode = mode;
+    disp->info_row_scroll[row].speed = speed > 0 ? speed : 0;
+    scroll_restart(&disp->info_row_scroll[row]);
+}
+
 // shorthand for formatting given row to given times in [h:]mm:ss.0 / [h:]mm:ss.0 format
 void infodisplay_set_row_times(INFODISPLAY *disp, int row, int time1_ms, int time2_ms)
 {
@@ -774,18 +890,19 @@ static void draw_progress(INFODISPLAY *disp, int progress_bar_y)
 static time_t s_start_time_sec = 0;
 
 // Renders the current display state to the backbuffer (disp->backbuf).
-// If ret_req!=NULL, writes value to it where non-zero value means request for
-// new refresh on next available frame (instead of waiting for outside event).
-void infodisplay_update(INFODISPLAY *disp, int *ret_req)
+// If ret_next_ms!=NULL, writes to it the milliseconds until the next visible
+// change (scrolled pixel, clock second or icon frame), at least
+// INFODISPLAY_MIN_FRAME_MS, or -1 if the display only changes by outside events.
+void infodisplay_update(INFODISPLAY *disp, int *ret_next_ms)
 {
     int y, progress_bar_y = 0;
-    struct timeval tv;
+    struct timeval tv = { 0, 0 };
     int anim_time_ms = 0;
-    int req_refresh = 0;
+    int next_ms = -1;
     float anim_time_delta_s = 0;
 
-    if (ret_req != NULL)
-        *ret_req = 0;
+    if (ret_next_ms != NULL)
+        *ret_next_ms = -1;
 
     if (disp == NULL || disp->backbuf == NULL)
         return;
@@ -854,11 +971,15 @@ void infodisplay_update(INFODISPLAY *disp, int *ret_req)
             {
                 int anim_frame = anim_time_ms * ICON_BUFFERING_FRAMES / animation_cycle_length_ms;
                 icon = icon_buffering[anim_frame % ICON_BUFFERING_FRAMES];
+                schedule_change(&next_ms, ((anim_frame + 1) * animation_cycle_length_ms + ICON_BUFFERING_FRAMES - 1) /
+                                          ICON_BUFFERING_FRAMES - anim_time_ms);
             }
             else if (disp->info_row_icon[row] == INFODISPLAY_ICON_WAITING)
             {
                 int anim_frame = anim_time_ms * ICON_WAITING_FRAMES / animation_cycle_length_ms;
                 icon = icon_waiting[anim_frame % ICON_WAITING_FRAMES];
+                schedule_change(&next_ms, ((anim_frame + 1) * animation_cycle_length_ms + ICON_WAITING_FRAMES - 1) /
+                                          ICON_WAITING_FRAMES - anim_time_ms);
             }
             else if (disp->info_row_icon[row] == INFODISPLAY_ICON_MEMCARD)
             {
@@ -916,7 +1037,7 @@ void infodisplay_update(INFODISPLAY *disp, int *ret_req)
                     disp->info_row_last_update[row] = now;
                 }
                 scroll_enabled = 0; // scrolling is not supported for clock rows
-                req_refresh = 1; // TODO: more fine-grained refresh req (scheduled time)
+                schedule_change(&next_ms, 1000 - tv.tv_usec / 1000); // next second
             }
 
             int rem_horiz_space = disp->width - x;
@@ -927,43 +1048,38 @@ void infodisplay_update(INFODISPLAY *disp, int *ret_req)
             {
                 //int th = mini(disp->info_row_textsurf[row]->h, disp->row_height);
 
+                INFODISPLAY_SCROLL *sc = &disp->info_row_scroll[row];
+                int draw_width = mini(rem_horiz_space, tw);
+
                 if (scroll_enabled && tw > rem_horiz_space)
                 {
-                    float anim_time_s = disp->info_row_scroll_time_s[row];
-                    int scroll_length_pix = tw - rem_horiz_space;
-                    float scroll_length_s = scroll_length_pix / scroll_speed_pix_per_s;
-                    float period_length_s = 2.0f * scroll_length_s +
-                        scroll_startpoint_delay_s + scroll_endpoint_delay_s;
-                    float scroll_time_s = fmodf(anim_time_s, period_length_s);
-                    // v Period:      
-                    // |     _c_      .
-                    // |    /   \     .
-                    // |_a_/b   d\    .
-                    // +------------t .
-                    // a = startpoint delay
-                    // b = scroll forwards
-                    // c = endpoint delay
-                    // d = scroll backwards
-                    // uss = start of scroll forwards slope b (end of a)
-                    // use = end of scroll forwards slope b (start of c)
-                    // dss = start of scroll backwards slope d (end of c)
-                    // dse = end of scroll backdwards slope d (start of a, wrap)
-                    float scroll_uss = scroll_startpoint_delay_s;
-                    float scroll_use = scroll_uss + scroll_length_s;
-                    float scroll_dss = scroll_use + scroll_endpoint_delay_s;
-                    float scroll_dse = scroll_dss + scroll_length_s;
-                    float scroll_val = boxpulsef(scroll_time_s,
-                                                 scroll_uss, scroll_use,
-                                                 scroll_dss, scroll_dse);
-                    tx = (int)(x - scroll_val * scroll_length_pix);
-
-                    disp->info_row_scroll_time_s[row] += anim_time_delta_s;
-                    req_refresh = 1; // scrolling row, need constant refresh
+                    int marquee = sc->mode == INFODISPLAY_SCROLL_MARQUEE;
+                    int ring_width = tw + marquee_gap(disp); // text and gap
+                    int range = marquee ? ring_width : tw - rem_horiz_space;
+                    float next_s = scroll_step(sc, anim_time_delta_s, range, rem_horiz_space);
+                    int offs = (int)floorf(sc->pos);
+
+                    // redraw when the offset moves a whole pixel, limited below
+                    schedule_change(&next_ms, (int)ceilf(next_s * 1000.0f));
+
+                    if (marquee)
+                    {
+                        // the ring from offs to its end, then from its start
+                        // for what is left, never more than two blits
+                        int tail_width = ring_width - offs;
+                        blit_row_textsurf(disp, row, x, ty, offs, tail_width,
+                                          x, y, rem_horiz_space, disp->row_height);
+                        if (tail_width < rem_horiz_space)
+                            blit_row_textsurf(disp, row, x + tail_width, ty, 0, rem_horiz_space - tail_width,
+                                              x, y, rem_horiz_space, disp->row_height);
+                        draw_width = 0;
+                    }
+                    tx = x - offs;
                 }
 
-                int draw_width = mini(rem_horiz_space, tw);
-                blit_row_textsurf(disp, row, tx, ty,     // target, row #, text pos
-                                  x, y, draw_width, disp->row_height); // clip rect
+                if (draw_width > 0)
+                    blit_row_textsurf(disp, row, tx, ty, 0, tw, // target, row #, text pos, src columns
+                                      x, y, draw_width, disp->row_height); // clip rect
             } // tw > 0
         } // text on row != NULL
 
@@ -982,9 +1098,13 @@ void infodisplay_update(INFODISPLAY *disp, int *ret_req)
         draw_progress(disp, progress_bar_y);
     }
 
-    if (!req_refresh)
+    if (next_ms < 0)
         disp->prev_anim_time_ms = 0; // reset anim time delta (unknown time until next refresh)
 
-    if (ret_req != NULL)
-        *ret_req |= req_refresh;
+    // no faster than the frame limit, scrolling catches up by frame time
+    if (next_ms >= 0 && next_ms < INFODISPLAY_MIN_FRAME_MS)
+        next_ms = INFODISPLAY_MIN_FRAME_MS;
+
+    if (ret_next_ms != NULL)
+        *ret_next_ms = next_ms;
 }
@@ -14,6 +14,9 @@ typedef PIXEL16 PIXEL; // hardcoded to 16bpp for now, maybe expand format suppor
 #define INFODISPLAY_ROW_COUNT 7
 #define INFODISPLAY_DEFAULT_PROGRESS_BAR_ROW (INFODISPLAY_ROW_COUNT - 2)
 #define INFODISPLAY_DEFAULT_PROGRESS_BAR_COLOR ((unsigned long)0xfff12b24)
+// shortest time between scheduled redraws, fast scrolling moves
+// several pixels per frame instead of redrawing more often
+#define INFODISPLAY_MIN_FRAME_MS 25
 
 
 typedef enum INFODISPLAY_ICON_ENUM
@@ -41,6 +44,24 @@ typedef enum INFODISPLAY_ROW_TYPE_ENUM
     INFODISPLAY_ROW_TYPE_COUNT //
 } INFODISPLAY_ROW_TYPE;
     
+typedef enum INFODISPLAY_SCROLL_MODE_ENUM
+{
+    INFODISPLAY_SCROLL_PINGPONG = 0, // back and forth, pausing at both ends
+    INFODISPLAY_SCROLL_MARQUEE, // continuous loop with a gap between repeats
+    INFODISPLAY_SCROLL_PAGE, // flips a visible width at a time
+    INFODISPLAY_SCROLL_MODE_COUNT //
+} INFODISPLAY_SCROLL_MODE;
+
+// scroll state of a row too long to fit, advanced by frame time
+typedef struct _INFODISPLAY_SCROLL
+{
+    INFODISPLAY_SCROLL_MODE mode;
+    float speed; // pixels per second, 0 for the default
+    float pos; // scroll offset in pixels, drawn rounded down
+    float hold_s; // time left to stay in place before moving (or flipping)
+    int dir; // pingpong direction, 1 forwards or -1 backwards
+} INFODISPLAY_SCROLL;
+
 typedef struct _TTF_Font TTF_Font;
 typedef struct _TTF_Surface TTF_Surface;
 
@@ -63,7 +84,7 @@ typedef struct _INFODISPLAY
     int info_row_mem[INFODISPLAY_ROW_COUNT]; // amount of bytes per row allocated
     INFODISPLAY_ICON info_row_icon[INFODISPLAY_ROW_COUNT]; // icon state for each row
     TTF_Surface *info_row_textsurf[INFODISPLAY_ROW_COUNT]; // cached rendered texts
-    float info_row_scroll_time_s[INFODISPLAY_ROW_COUNT]; // row scroll times in seconds
+    INFODISPLAY_SCROLL info_row_scroll[INFODISPLAY_ROW_COUNT]; // row scroll state
     int info_row_text_width[INFODISPLAY_ROW_COUNT]; // cached text width
     unsigned long info_row_color[INFODISPLAY_ROW_COUNT]; // text color for each row
     unsigned long info_row_bkg_color[INFODISPLAY_ROW_COUNT]; // background color for each row
@@ -80,6 +101,9 @@ extern INFODISPLAY * infodisplay_create(int width, int height,
                                         const char *ttf_filename);
 // closes infodisplay and frees its memory
 extern void infodisplay_close(INFODISPLAY *disp);
+// adds a fallback font for characters missing from the main font,
+// loaded only when such a character is first drawn. returns 0 on success.
+extern int infodisplay_add_fallback_font(INFODISPLAY *disp, const char *ttf_filename);
 
 // row=[-1..INFODISPLAY_ROW_COUNT] progress=[0..1]
 extern void infodisplay_set_progress(INFODISPLAY *disp, int row, float progress, unsigned long color);
@@ -89,12 +113,16 @@ extern void infodisplay_set_row_color(INFODISPLAY *disp, int row, unsigned long
 extern void infodisplay_set_row_text(INFODISPLAY *disp, int row, int type, const char *text);
 // sets row icon
 extern void infodisplay_set_row_icon(INFODISPLAY *disp, int row, INFODISPLAY_ICON icon);
+// row=[0..INFODISPLAY_ROW_COUNT[, speed in pixels per second (<=0 for default),
+// restarts the row scrolling from the beginning
+extern void infodisplay_set_row_scroll(INFODISPLAY *disp, int row, INFODISPLAY_SCROLL_MODE mode, float speed);
 // shorthand for formatting given row to given times in [h:]mm:ss.0 / [h:]mm:ss.0 format
 extern void infodisplay_set_row_times(INFODISPLAY *disp, int row, int time1_ms, int time2_ms);
 // Renders the current display state to the backbuffer (disp->backbuf).
-// If ret_req!=NULL, writes value to it where non-zero value means request for
-// new refresh on next available frame (instead of waiting for outside event).
-extern void infodisplay_update(INFODISPLAY *disp, int *ret_req);
+// If ret_next_ms!=NULL, writes to it the milliseconds until the next visible
+// change (scrolled pixel, clock second or icon frame), at least
+// INFODISPLAY_MIN_FRAME_MS, or -1 if the display only changes by outside events.
+extern void infodisplay_update(INFODISPLAY *disp, int *ret_next_ms);
 
 #ifdef __cplusplus
 }
@@ -2,8 +2,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <syslog.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <linux/fb.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
@@ -13,6 +15,8 @@
 #include "debug.h"
 #include "input.h"
 #include "infodisplay.h"
+#include "ttf.h"
+#include "ramebus.h"
 
 
 #define VERSION_MAJOR 1
@@ -21,7 +25,19 @@
 
 #define TTF_DEFAULT_FILENAME "/usr/share/fonts/TTF/ramefbcp.ttf"
 
-#define SLEEP_MILLISECONDS_PER_FRAME 25
+// frame interval while cloning video, otherwise frames are drawn
+// only when the infodisplay content changes
+#define SLEEP_MILLISECONDS_PER_FRAME INFODISPLAY_MIN_FRAME_MS
+
+#define BUS_MAX_SUBSCRIPTIONS 8
+#define INPUT_LINE_SIZE 256
+
+// Row colors and icons for the studio alert states (ramebus_alert order),
+// the NONE state restores what the row had before the alert.
+#define ALERT_ON_COLOR      ((unsigned long)0xffffffff)
+#define ALERT_ON_BKG_COLOR  ((unsigned long)0xffc01010)
+#define ALERT_BLINK_COLOR      ((unsigned long)0xff000000)
+#define ALERT_BLINK_BKG_COLOR  ((unsigned long)0xffffc020)
 
 // Scale input video to rect with this aspect ratio:
 #define VID_ASPECT_W 16
@@ -31,6 +47,26 @@
 static int s_alive = 1;
 
 static const char *s_ttf_filename = NULL;
+static const char *s_ttf_fallback_filenames[TTF_MAX_FALLBACK_FONTS];
+static int s_ttf_fallback_count = 0;
+
+// event bus, see -m, -a and -s
+static const char *s_bus_broker = NULL;
+static int s_alert_row = -1;
+static const char *s_bus_topics[BUS_MAX_SUBSCRIPTIONS];
+static const char *s_bus_prefixes[BUS_MAX_SUBSCRIPTIONS];
+static int s_bus_topic_count = 0;
+
+typedef struct _BUS_CTX
+{
+    INFODISPLAY *infodisplay;
+    int *video_enabled;
+    int need_refresh;
+    int alert; // current ramebus_alert state
+    // row state saved when an alert starts, restored when it ends
+    unsigned long saved_color, saved_bkg_color;
+    INFODISPLAY_ICON saved_icon;
+} BUS_CTX;
 
 static void print_fb_info(struct fb_var_screeninfo *vinfo, struct fb_fix_screeninfo *finfo)
 {
@@ -108,8 +144,15 @@ static unsigned long parse_hex_color(const char *str)
 }
 
 
-static void translate_input_line(INFODISPLAY *infodisplay, int *video_enabled, const char *line)
+// Lines from stdin and from the bus. While an alert is shown on the alert
+// row, color and icon changes for that row go to the state restored when
+// the alert ends.
+static void translate_input_line(BUS_CTX *ctx, const char *line)
 {
+    INFODISPLAY *infodisplay = ctx->infodisplay;
+    int *video_enabled = ctx->video_enabled;
+    const int alert_shown = ctx->alert != RAMEBUS_ALERT_NONE;
+
     switch (line[0])
     {
         case 'X':
@@ -149,7 +192,13 @@ static void translate_input_line(INFODISPLAY *infodisplay, int *video_enabled, c
             if (strlen(tmp) >= 6)
             {
                 unsigned long color = parse_hex_color(tmp);
-                infodisplay_set_row_color(infodisplay, rown, color, bkg_color);
+                if (alert_shown && rown == s_alert_row)
+                {
+                    ctx->saved_color = color;
+                    ctx->saved_bkg_color = bkg_color;
+                }
+                else
+                    infodisplay_set_row_color(infodisplay, rown, color, bkg_color);
             }
         }
         break;
@@ -216,9 +265,28 @@ static void translate_input_line(INFODISPLAY *infodisplay, int *video_enabled, c
                 value = INFODISPLAY_ICON_NONE;
             if (rown < 0 || rown >= INFODISPLAY_ROW_COUNT)
                 rown = INFODISPLAY_ROW_COUNT - 1;
-            infodisplay_set_row_icon(infodisplay,
-                                     rown,
-                                     (INFODISPLAY_ICON)value);
+            if (alert_shown && rown == s_alert_row)
+                ctx->saved_icon = (INFODISPLAY_ICON)value;
+            else
+                infodisplay_set_row_icon(infodisplay,
+                                         rown,
+                                         (INFODISPLAY_ICON)value);
+        }
+        break;
+
+        case 'R':
+        {
+            // set scroll mode and optional speed (pixels per second) for the row,
+            // mode 0 = back and forth, 1 = marquee loop, 2 = page flip
+            // e.g. "R5:1" or "R5:0,35.5"
+            int rown = line[1] - '1';
+            float speed = 0;
+            if (rown < 0 || rown >= INFODISPLAY_ROW_COUNT || line[2] != ':' ||
+                line[3] < '0' || line[3] > '9')
+                break;
+            if (line[4] == ',')
+                speed = atof(&line[5]);
+            infodisplay_set_row_scroll(infodisplay, rown, (INFODISPLAY_SCROLL_MODE)(line[3] - '0'), speed);
         }
         break;
 
@@ -265,6 +333,122 @@ static void translate_input_line(INFODISPLAY *infodisplay, int *video_enabled, c
 }
 
 
+static void set_alert_row(BUS_CTX *ctx, int alert)
+{
+    INFODISPLAY *disp = ctx->infodisplay;
+    const int row = s_alert_row;
+
+    if (disp == NULL || row < 0 || alert == ctx->alert)
+        return;
+
+    if (ctx->alert == RAMEBUS_ALERT_NONE)
+    {
+        ctx->saved_color = disp->info_row_color[row];
+        ctx->saved_bkg_color = disp->info_row_bkg_color[row];
+        ctx->saved_icon = disp->info_row_icon[row];
+    }
+
+    switch (alert)
+    {
+        case RAMEBUS_ALERT_ON:
+            infodisplay_set_row_color(disp, row, ALERT_ON_COLOR, ALERT_ON_BKG_COLOR);
+            infodisplay_set_row_icon(disp, row, INFODISPLAY_ICON_RECORDING);
+            break;
+        case RAMEBUS_ALERT_BLINK:
+            // the waiting icon is animated, which keeps the row refreshing
+            infodisplay_set_row_color(disp, row, ALERT_BLINK_COLOR, ALERT_BLINK_BKG_COLOR);
+            infodisplay_set_row_icon(disp, row, INFODISPLAY_ICON_WAITING);
+            break;
+        default:
+            infodisplay_set_row_color(disp, row, ctx->saved_color, ctx->saved_bkg_color);
+            infodisplay_set_row_icon(disp, row, ctx->saved_icon);
+            break;
+    }
+    ctx->alert = alert;
+    ctx->need_refresh = 1;
+}
+
+
+// Payloads of the -s topics are handled like stdin lines, prefixed with the
+// topic's prefix if one was given (e.g. "X2:" to show the payload as text).
+static void on_bus_message(struct ramebus *bus, const struct ramebus_msg *msg, void *user)
+{
+    BUS_CTX *ctx = (BUS_CTX *)user;
+    char line[INPUT_LINE_SIZE], payload[INPUT_LINE_SIZE];
+    const char *data;
+    int data_len;
+
+    if (msg->type == RAMEBUS_MSG_CONNECTION)
+    {
+        // a stale alert is not shown while the broker is away
+        if (!msg->connected)
+            set_alert_row(ctx, RAMEBUS_ALERT_NONE);
+        return;
+    }
+    if (msg->type == RAMEBUS_MSG_ALERT && s_alert_row >= 0)
+        set_alert_row(ctx, msg->alert);
+    if (ctx->infodisplay == NULL)
+        return;
+
+    if (msg->type == RAMEBUS_MSG_RAW)
+    {
+        data = (const char *)msg->raw.data;
+        data_len = msg->raw.len;
+    }
+    else
+    {
+        // typed alert and stopwatch messages as their payload text,
+        // for -s subscriptions to those topics
+        const char *topic;
+        data = payload;
+        data_len = ramebus_encode(msg, &topic, payload, sizeof(payload));
+        if (data_len < 0)
+            return;
+    }
+
+    for (int a = 0; a < s_bus_topic_count; ++a)
+    {
+        const char *prefix = s_bus_prefixes[a];
+        int pos = 0, prefix_len = strlen(prefix);
+
+        if (!ramebus_topic_match(s_bus_topics[a], msg->topic))
+            continue;
+
+        // a payload can hold several lines
+        while (pos < data_len)
+        {
+            int len = 0;
+            while (pos + len < data_len && data[pos + len] != '\n')
+                ++len;
+            if (len > (int)sizeof(line) - prefix_len - 1)
+                len = sizeof(line) - prefix_len - 1;
+            memcpy(line, prefix, prefix_len);
+            memcpy(line + prefix_len, data + pos, len);
+            line[prefix_len + len] = 0;
+            while (pos < data_len && data[pos] != '\n')
+                ++pos;
+            ++pos;
+
+            dbg_printf("Bus line: %s\n", line);
+            translate_input_line(ctx, line);
+            ctx->need_refresh = 1;
+        }
+        break;
+    }
+}
+
+
+// poll timeout of the earlier of two waits, -1 = no wait
+static int min_timeout(int a, int b)
+{
+    if (a < 0)
+        return b;
+    if (b < 0)
+        return a;
+    return a < b ? a : b;
+}
+
+
 static int process()
 {
     struct fb_var_screeninfo fbvinfo;
@@ -285,8 +469,12 @@ static int process()
     int vid_w = 0, vid_h = 0;
     INFODISPLAY *infodisplay = NULL;
     INPUT_CTX *inputctx = NULL;
+    struct ramebus *bus = NULL;
+    BUS_CTX bus_ctx;
+    struct pollfd pfd[2];
 
     int need_to_refresh_display = 0;
+    long long next_change_ms = -1; // monotonic time of the next scheduled display change
 
 
     bcm_host_init();
@@ -371,6 +559,8 @@ static int process()
                                          fbvinfo.blue.offset, fbvinfo.blue.length,
                                          fbvinfo.transp.offset, fbvinfo.transp.length,
                                          s_ttf_filename);
+        for (int a = 0; a < s_ttf_fallback_count; ++a)
+            infodisplay_add_fallback_font(infodisplay, s_ttf_fallback_filenames[a]);
     }
     else
     {
@@ -379,10 +569,27 @@ static int process()
         dbg_printf(warnfmt, fbvinfo.bits_per_pixel, sizeof(PIXEL));
     }
 
+    memset(&bus_ctx, 0, sizeof(bus_ctx));
+    bus_ctx.infodisplay = infodisplay;
+    bus_ctx.video_enabled = &video_enabled;
+    bus_ctx.alert = RAMEBUS_ALERT_NONE;
+    if (s_bus_broker != NULL)
+    {
+        bus = ramebus_new(on_bus_message, &bus_ctx);
+        if (s_alert_row >= 0)
+            ramebus_subscribe(bus, RAMEBUS_TOPIC_ALERT);
+        for (int a = 0; a < s_bus_topic_count; ++a)
+            ramebus_subscribe(bus, s_bus_topics[a]);
+        if (ramebus_connect(bus, s_bus_broker) != 0)
+            syslog(LOG_WARNING, "Unable to connect to event bus %s", s_bus_broker);
+    }
+
     while (s_alive)
     {
-        int update_req_refresh = 0;
-        const int LINESIZE = 256;
+        int next_ms = -1;
+        int timeout;
+        long long now;
+        const int LINESIZE = INPUT_LINE_SIZE;
         char line[LINESIZE];
 
         if (video_enabled)
@@ -407,22 +614,24 @@ static int process()
                 {
                     dbg_printf("Line: %s\n", line);
 
-                    translate_input_line(infodisplay, &video_enabled, line);
+                    translate_input_line(&bus_ctx, line);
                     need_to_refresh_display = 1;
                     try_read_more = 1;
                 }
             } while (try_read_more);
         }
 
-        // always refresh display when an animated icon is in use
-        for (int a = 0; a < INFODISPLAY_ROW_COUNT; ++a)
+        if (bus_ctx.need_refresh)
         {
-            INFODISPLAY_ICON i = infodisplay->info_row_icon[a];
-            if (i == INFODISPLAY_ICON_BUFFERING ||
-                i == INFODISPLAY_ICON_WAITING)
-                need_to_refresh_display = 1;
+            need_to_refresh_display = 1;
+            bus_ctx.need_refresh = 0;
         }
 
+        // scrolling, clock rows and animated icons change on their own
+        now = ramebus_now_ms();
+        if (next_change_ms >= 0 && now >= next_change_ms)
+            need_to_refresh_display = 1;
+
         if (infodisplay != NULL && need_to_refresh_display)
         {
             //// hardcoded infodisplay update test:
@@ -432,7 +641,8 @@ static int process()
             //infodisplay_set_row_times(infodisplay, 6, frame * 40,
             //                          345*60*60*1000 + 45*60*1000+32*1000+100);
 
-            infodisplay_update(infodisplay, &update_req_refresh);
+            infodisplay_update(infodisplay, &next_ms);
+            next_change_ms = next_ms >= 0 ? now + next_ms : -1;
 
             if (video_enabled)
             {
@@ -450,11 +660,27 @@ static int process()
             }
         }
 
-        usleep(SLEEP_MILLISECONDS_PER_FRAME * 1000);
+        // wait for the next video frame or display change,
+        // woken early by input or a bus message
+        timeout = video_enabled ? SLEEP_MILLISECONDS_PER_FRAME : -1;
+        if (next_change_ms >= 0)
+            timeout = min_timeout(timeout, (int)(next_change_ms > now ? next_change_ms - now : 0));
+        if (bus != NULL)
+            timeout = min_timeout(timeout, ramebus_timeout(bus));
+        pfd[0].fd = inputctx != NULL ? inputctx->infd : -1;
+        pfd[0].events = POLLIN;
+        pfd[0].revents = 0;
+        pfd[1].fd = bus != NULL ? ramebus_fd(bus) : -1;
+        pfd[1].events = bus != NULL ? ramebus_events(bus) : 0;
+        pfd[1].revents = 0;
+        poll(pfd, 2, timeout);
+        if (bus != NULL)
+            ramebus_service(bus, pfd[1].revents);
         ++frame;
-        need_to_refresh_display = update_req_refresh;
+        need_to_refresh_display = 0;
     }
 
+    ramebus_free(bus);
     infodisplay_close(infodisplay);
     input_close(inputctx);
 
@@ -517,6 +743,72 @@ int main(int argc, char **argv)
             }
         }
 
+        if (strcmp(argv[a], "-F") == 0)
+        {
+            if (a + 1 < argc && argv[a + 1] != NULL)
+            {
+                if (s_ttf_fallback_count < TTF_MAX_FALLBACK_FONTS)
+                {
+                    dbg_printf("Using fallback font: %s\n", argv[a + 1]);
+                    s_ttf_fallback_filenames[s_ttf_fallback_count++] = argv[a + 1];
+                }
+                else
+                {
+                    const char *warnfmt = "Too many fallback fonts, ignoring %s\n";
+                    syslog(LOG_WARNING, warnfmt, argv[a + 1]);
+                    fprintf(stderr, warnfmt, argv[a + 1]);
+                }
+                ++a;
+                continue;
+            }
+        }
+
+        if (strcmp(argv[a], "-m") == 0)
+        {
+            if (a + 1 < argc && argv[a + 1] != NULL)
+            {
+                s_bus_broker = argv[a + 1];
+                ++a;
+                continue;
+            }
+        }
+
+        if (strcmp(argv[a], "-a") == 0)
+        {
+            if (a + 1 < argc && argv[a + 1] != NULL)
+            {
+                int rown = atoi(argv[a + 1]) - 1;
+                if (rown >= 0 && rown < INFODISPLAY_ROW_COUNT)
+                    s_alert_row = rown;
+                ++a;
+                continue;
+            }
+        }
+
+        if (strcmp(argv[a], "-s") == 0)
+        {
+            if (a + 1 < argc && argv[a + 1] != NULL)
+            {
+                // "topic" or "topic=prefix", split in place
+                char *eq = strchr(argv[a + 1], '=');
+                if (s_bus_topic_count < BUS_MAX_SUBSCRIPTIONS)
+                {
+                    if (eq != NULL)
+                        *eq = 0;
+                    s_bus_topics[s_bus_topic_count] = argv[a + 1];
+                    s_bus_prefixes[s_bus_topic_count++] = eq != NULL ? eq + 1 : "";
+                }
+                else
+                {
+                    const char *warnfmt = "Too many subscriptions, ignoring %s\n";
+                    syslog(LOG_WARNING, warnfmt, argv[a + 1]);
+                    fprintf(stderr, warnfmt, argv[a + 1]);
+                }
+                ++a;
+                continue;
+            }
+        }
+
         #ifdef DEBUG_SUPPORT
         if (strcmp(argv[a], "-d") == 0)
             g_debug_info = 1;
@@ -532,6 +824,18 @@ int main(int argc, char **argv)
                    "  -f /path/font.ttf\n"
                    "     \t Use given font instead of built-in default.\n"
                    "     \t (default: " TTF_DEFAULT_FILENAME ")\n"
+                   "  -F /path/fallback.ttf\n"
+                   "     \t Font for characters missing from the main font.\n"
+                   "     \t Can be given up to 4 times, searched in order.\n"
+                   "  -m host[:port]\n"
+                   "     \t Connect to the event bus broker (\"local\" for none).\n"
+                   "  -a row\n"
+                   "     \t Show the studio alert state on the given row [1..9]\n"
+                   "     \t as row colors and icon (needs -m).\n"
+                   "  -s topic[=prefix]\n"
+                   "     \t Subscribe to topic, payload lines are handled as input\n"
+                   "     \t lines after the prefix, e.g. \"rame/ip=X2:\" (needs -m).\n"
+                   "     \t Can be given up to 8 times.\n"
                    "  -d \t Output debug info to stdout. "
                        #ifdef DEBUG_SUPPORT
                        "(available)\n"
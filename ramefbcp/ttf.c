@@ -40,6 +40,7 @@
 #define USE_FREETYPE_ERRORS
 
 #include "ttf.h"
+#include "ramefont.h"
 
 
 typedef int8_t Sint8;
@@ -56,7 +57,7 @@ typedef uint64_t Uint64;
 #define UNICODE_BOM_SWAPPED 0xFFFE
 
 
-static Uint16 ttf_glyph_not_found_char = '?'; // set to 0 to disable this
+static Uint32 ttf_glyph_not_found_char = '?'; // set to 0 to disable this
 
 
 #define TTF_ERRBUFSIZE 128
@@ -91,9 +92,30 @@ char * TTF_GetError(void)
 #define CACHED_BITMAP   0x01
 #define CACHED_PIXMAP   0x02
 
+/* Kerning pair cache: dense table for pairs of low glyph indices (covers
+   the Latin-1 glyphs in typical fonts), direct mapped hash for the rest.
+   Values are in whole pixels, as applied by the renderers. */
+#define KERN_DENSE_GLYPHS   256
+#define KERN_DENSE_UNKNOWN  (-128)
+#define KERN_CACHE_SIZE     509 /* prime */
+
+typedef struct cached_kerning {
+    Uint32 key; /* (prev_index << 16) | index, 0 = empty */
+    int delta;
+} c_kerning;
+
+/* Per-code point coverage cache: which face provides a code point,
+   in lazily allocated pages of 256 code points behind a page table that
+   is only allocated once a font with fallbacks looks up a code point */
+#define COVERAGE_PAGE_BITS  8
+#define COVERAGE_PAGES      (0x110000 >> COVERAGE_PAGE_BITS)
+#define COVERAGE_UNKNOWN    0
+#define COVERAGE_PRIMARY    1 /* fallback n is stored as COVERAGE_PRIMARY+1+n */
+
 /* Cached glyph information */
 typedef struct cached_glyph {
     int stored;
+    FT_Face face;
     FT_UInt index;
     FT_Bitmap bitmap;
     FT_Bitmap pixmap;
@@ -103,7 +125,7 @@ typedef struct cached_glyph {
     int maxy;
     int yoffset;
     int advance;
-    Uint16 cached;
+    Uint32 cached;
 } c_glyph;
 
 
@@ -183,6 +205,18 @@ struct _TTF_Font {
     /* Whether kerning is desired */
     int kerning;
 
+    /* Lazily filled kerning caches (see Get_Kerning) */
+    Sint8 *kern_dense;
+    c_kerning kern_cache[KERN_CACHE_SIZE];
+
+    /* Fallback fonts for code points missing from this face, in priority
+       order; opened at the same size when first needed (see Find_Face) */
+    int ptsize;
+    int num_fallbacks;
+    char *fallback_file[TTF_MAX_FALLBACK_FONTS];
+    TTF_Font *fallback[TTF_MAX_FALLBACK_FONTS];
+    Uint8 **coverage;
+
     /* Extra width in glyph bounds for text styles */
     int glyph_overhang;
     float glyph_italics;
@@ -207,6 +241,9 @@ struct _TTF_Font {
     int hinting;
 };
 
+/* Glyph index usable for kerning, 0 if the glyph comes from a fallback face */
+#define TTF_KERNING_INDEX(font, glyph) ((glyph)->face == (font)->face ? (glyph)->index : 0)
+
 /* Handle a style only if the font does not already handle it */
 #define TTF_HANDLE_STYLE_BOLD(font) (((font)->style & TTF_STYLE_BOLD) && \
                                     !((font)->face_style & TTF_STYLE_BOLD))
@@ -221,7 +258,6 @@ struct _TTF_Font {
 /* The FreeType font engine/library */
 static FT_Library library;
 static int TTF_initialized = 0;
-static int TTF_byteswapped = 0;
 
 #define TTF_CHECKPOINTER_NO_ERRVAL(p)                 \
     if ( !TTF_initialized ) {                   \
@@ -283,9 +319,9 @@ int TTF_Init( void )
     int status = 0;
 
     if ( ! TTF_initialized ) {
-        FT_Error error = FT_Init_FreeType( &library );
-        if ( error ) {
-            TTF_SetFTError("Couldn't init FreeType engine", error);
+        library = ramefont_init();
+        if ( ! library ) {
+            TTF_SetError("Couldn't init FreeType engine");
             status = -1;
         }
     }
@@ -318,16 +354,13 @@ static unsigned long RWread(
     return (unsigned long)SDL_RWread( src, buffer, 1, (int)count );
 }
 
+static TTF_Font* Init_Font( TTF_Font* font, int ptsize, long index );
+
 TTF_Font* TTF_OpenFontIndexRW( SDL_RWops *src, int freesrc, int ptsize, long index )
 {
     TTF_Font* font;
-    FT_Error error;
-    FT_Face face;
-    FT_Fixed scale;
     FT_Stream stream;
-    FT_CharMap found;
     Sint64 position;
-    int i;
 
     if ( ! TTF_initialized ) {
         TTF_SetError( "Library not initialized" );
@@ -381,7 +414,24 @@ TTF_Font* TTF_OpenFontIndexRW( SDL_RWops *src, int freesrc, int ptsize, long ind
     font->args.flags = FT_OPEN_STREAM;
     font->args.stream = stream;
 
-    error = FT_Open_Face( library, &font->args, index, &font->face );
+    return Init_Font( font, ptsize, index );
+}
+
+/* Opens the face described by font->args, unless already open,
+   and sets up its metrics */
+static TTF_Font* Init_Font( TTF_Font* font, int ptsize, long index )
+{
+    FT_Error error = 0;
+    FT_Face face;
+    FT_Fixed scale;
+    FT_CharMap found;
+    int i;
+
+    font->ptsize = ptsize;
+
+    if ( ! font->face ) {
+        error = FT_Open_Face( library, &font->args, index, &font->face );
+    }
     if ( error ) {
         TTF_SetFTError( "Couldn't load font file", error );
         TTF_CloseFont( font );
@@ -497,15 +547,33 @@ TTF_Font* TTF_OpenFontRW( SDL_RWops *src, int freesrc, int ptsize )
     return TTF_OpenFontIndexRW(src, freesrc, ptsize, 0);
 }
 
+/* Fonts opened by file name come from the shared font service, which maps
+   each font file to memory once: glyph loads don't go through stdio, and
+   the pages are shared with the other tools using the same font file. */
 TTF_Font* TTF_OpenFontIndex( const char *file, int ptsize, long index )
 {
-    SDL_RWops *rw = SDL_RWFromFile(file, "rb");
-    if ( rw == NULL ) {
-        //TTF_SetError(SDL_GetError());
-        TTF_SetError("TTF cannot open font file");
+    TTF_Font* font;
+    FT_Error error;
+
+    if ( ! TTF_initialized ) {
+        TTF_SetError( "Library not initialized" );
         return NULL;
     }
-    return TTF_OpenFontIndexRW(rw, 1, ptsize, index);
+
+    font = (TTF_Font*) calloc(1, sizeof *font);
+    if ( font == NULL ) {
+        TTF_SetError( "Out of memory" );
+        return NULL;
+    }
+
+    error = ramefont_open_face( file, index, &font->face );
+    if ( error ) {
+        TTF_SetFTError( "Couldn't load font file", error );
+        free( font );
+        return NULL;
+    }
+
+    return Init_Font( font, ptsize, index );
 }
 
 TTF_Font* TTF_OpenFont( const char *file, int ptsize )
@@ -516,6 +584,7 @@ TTF_Font* TTF_OpenFont( const char *file, int ptsize )
 static void Flush_Glyph( c_glyph* glyph )
 {
     glyph->stored = 0;
+    glyph->face = NULL;
     glyph->index = 0;
     if ( glyph->bitmap.buffer ) {
         free( glyph->bitmap.buffer );
@@ -541,7 +610,61 @@ static void Flush_Cache( TTF_Font* font )
     }
 }
 
-static FT_Error Load_Glyph( TTF_Font* font, Uint16 ch, c_glyph* cached, int want )
+static TTF_Font* Open_Fallback( TTF_Font* font, int n )
+{
+    if ( !font->fallback[n] && font->fallback_file[n] ) {
+        font->fallback[n] = TTF_OpenFont( font->fallback_file[n], font->ptsize );
+        if ( !font->fallback[n] ) {
+            /* don't retry a font that failed to load */
+            free( font->fallback_file[n] );
+            font->fallback_file[n] = NULL;
+        }
+    }
+    return font->fallback[n];
+}
+
+/* Selects the face providing the code point: this font if it has a glyph
+   for it, otherwise the first fallback that does.  The result is kept in
+   the coverage cache, so the fallbacks are searched once per code point. */
+static FT_Face Find_Face( TTF_Font* font, Uint32 ch, FT_UInt* index )
+{
+    FT_Face face = font->face;
+    Uint8 *page, *slot;
+    int i;
+
+    if ( font->num_fallbacks > 0 && !font->coverage ) {
+        font->coverage = (Uint8 **)calloc( COVERAGE_PAGES, sizeof(Uint8 *) );
+    }
+    if ( font->coverage && ch < 0x110000 ) {
+        page = font->coverage[ch >> COVERAGE_PAGE_BITS];
+        if ( !page ) {
+            page = (Uint8 *)calloc( 1, 1 << COVERAGE_PAGE_BITS );
+            font->coverage[ch >> COVERAGE_PAGE_BITS] = page;
+        }
+        if ( page ) {
+            slot = &page[ch & ((1 << COVERAGE_PAGE_BITS) - 1)];
+            if ( *slot == COVERAGE_UNKNOWN ) {
+                *slot = COVERAGE_PRIMARY;
+                if ( !FT_Get_Char_Index( face, ch ) ) {
+                    for ( i = 0; i < font->num_fallbacks; ++i ) {
+                        TTF_Font *fallback = Open_Fallback( font, i );
+                        if ( fallback && FT_Get_Char_Index( fallback->face, ch ) ) {
+                            *slot = COVERAGE_PRIMARY + 1 + i;
+                            break;
+                        }
+                    }
+                }
+            }
+            if ( *slot != COVERAGE_PRIMARY ) {
+                face = font->fallback[*slot - COVERAGE_PRIMARY - 1]->face;
+            }
+        }
+    }
+    *index = FT_Get_Char_Index( face, ch );
+    return face;
+}
+
+static FT_Error Load_Glyph( TTF_Font* font, Uint32 ch, c_glyph* cached, int want )
 {
     FT_Face face;
     FT_Error error;
@@ -553,12 +676,11 @@ static FT_Error Load_Glyph( TTF_Font* font, Uint16 ch, c_glyph* cached, int want
         return FT_Err_Invalid_Handle;
     }
 
-    face = font->face;
-
     /* Load the glyph */
-    if ( ! cached->index ) {
-        cached->index = FT_Get_Char_Index( face, ch );
+    if ( ! cached->face ) {
+        cached->face = Find_Face( font, ch, &cached->index );
     }
+    face = cached->face;
     error = FT_Load_Glyph( face, cached->index, FT_LOAD_DEFAULT | font->hinting);
     if ( error ) {
         return error;
@@ -855,7 +977,7 @@ static FT_Error Load_Glyph( TTF_Font* font, Uint16 ch, c_glyph* cached, int want
     return 0;
 }
 
-static FT_Error Find_Glyph( TTF_Font* font, Uint16 ch, int want )
+static FT_Error Find_Glyph( TTF_Font* font, Uint32 ch, int want )
 {
     int retval = 0;
     int hsize = sizeof( font->cache ) / sizeof( font->cache[0] );
@@ -872,12 +994,88 @@ static FT_Error Find_Glyph( TTF_Font* font, Uint16 ch, int want )
     return retval;
 }
 
+/* Kerning between two glyph indices in pixels, looked up from FreeType
+   only the first time each pair is seen. */
+static int Get_Kerning( TTF_Font* font, FT_UInt prev_index, FT_UInt index )
+{
+    FT_Vector delta;
+    Sint8 *dense = NULL;
+    c_kerning *entry;
+    Uint32 key;
+
+    if ( prev_index < KERN_DENSE_GLYPHS && index < KERN_DENSE_GLYPHS ) {
+        if ( !font->kern_dense ) {
+            font->kern_dense = (Sint8 *)malloc( KERN_DENSE_GLYPHS * KERN_DENSE_GLYPHS );
+            if ( font->kern_dense ) {
+                memset( font->kern_dense, KERN_DENSE_UNKNOWN,
+                        KERN_DENSE_GLYPHS * KERN_DENSE_GLYPHS );
+            }
+        }
+        if ( font->kern_dense ) {
+            dense = font->kern_dense + prev_index * KERN_DENSE_GLYPHS + index;
+            if ( *dense != KERN_DENSE_UNKNOWN ) {
+                return *dense;
+            }
+        }
+    }
+
+    key = ((Uint32)prev_index << 16) | (index & 0xffff);
+    entry = &font->kern_cache[key % KERN_CACHE_SIZE];
+    if ( entry->key == key ) {
+        return entry->delta;
+    }
+
+    if ( FT_Get_Kerning( font->face, prev_index, index, ft_kerning_default, &delta ) ) {
+        delta.x = 0;
+    }
+    delta.x >>= 6;
+
+    /* values not fitting the dense table go to the hashed cache */
+    if ( dense && delta.x > KERN_DENSE_UNKNOWN && delta.x <= 127 ) {
+        *dense = (Sint8)delta.x;
+    } else {
+        entry->key = key;
+        entry->delta = (int)delta.x;
+    }
+    return (int)delta.x;
+}
+
+int TTF_AddFallbackFont( TTF_Font* font, const char *file )
+{
+    TTF_CHECKPOINTER(font, -1);
+
+    if ( font->num_fallbacks >= TTF_MAX_FALLBACK_FONTS ) {
+        TTF_SetError( "Too many fallback fonts" );
+        return -1;
+    }
+    font->fallback_file[font->num_fallbacks] = strdup( file );
+    if ( !font->fallback_file[font->num_fallbacks] ) {
+        TTF_SetError( "Out of memory" );
+        return -1;
+    }
+    ++font->num_fallbacks;
+    return 0;
+}
+
 void TTF_CloseFont( TTF_Font* font )
 {
+    int i;
+
     if ( font ) {
         Flush_Cache( font );
+        free( font->kern_dense );
+        for ( i = 0; i < font->num_fallbacks; ++i ) {
+            TTF_CloseFont( font->fallback[i] );
+            free( font->fallback_file[i] );
+        }
+        if ( font->coverage ) {
+            for ( i = 0; i < COVERAGE_PAGES; ++i ) {
+                free( font->coverage[i] );
+            }
+            free( font->coverage );
+        }
         if ( font->face ) {
-            FT_Done_Face( font->face );
+            ramefont_done_face( font->face );
         }
         if ( font->args.stream ) {
             free( font->args.stream );
@@ -906,44 +1104,6 @@ static void LATIN1_to_UTF8(const char *src, Uint8 *dst)
 }
 
 
-static Uint16 SDL_Swap16(Uint16 x)
-{
-    return (Uint16) ((x << 8) | (x >> 8));
-}
-
-/* Convert a UCS-2 string to a UTF-8 string */
-static void UCS2_to_UTF8(const Uint16 *src, Uint8 *dst)
-{
-    int swapped = TTF_byteswapped;
-
-    while (*src) {
-        Uint16 ch = *(Uint16*)src++;
-        if (ch == UNICODE_BOM_NATIVE) {
-            swapped = 0;
-            continue;
-        }
-        if (ch == UNICODE_BOM_SWAPPED) {
-            swapped = 1;
-            continue;
-        }
-        if (swapped) {
-            ch = SDL_Swap16(ch);
-        }
-        if (ch <= 0x7F) {
-            *dst++ = (Uint8) ch;
-        } else if (ch <= 0x7FF) {
-            *dst++ = 0xC0 | (Uint8) ((ch >> 6) & 0x1F);
-            *dst++ = 0x80 | (Uint8) (ch & 0x3F);
-        } else {
-            *dst++ = 0xE0 | (Uint8) ((ch >> 12) & 0x0F);
-            *dst++ = 0x80 | (Uint8) ((ch >> 6) & 0x3F);
-            *dst++ = 0x80 | (Uint8) (ch & 0x3F);
-        }
-    }
-    *dst = '\0';
-}
-
-
 /* Gets a unicode value from a UTF-8 encoded string and advance the string */
 #define UNKNOWN_UNICODE 0xFFFD
 static Uint32 UTF8_getch(const char **src, size_t *srclen)
@@ -958,6 +1118,11 @@ static Uint32 UTF8_getch(const char **src, size_t *srclen)
     if (*srclen == 0) {
         return UNKNOWN_UNICODE;
     }
+    if (p[0] < 0x80) {
+        ++*src;
+        --*srclen;
+        return (Uint32) p[0];
+    }
     if (p[0] >= 0xFC) {
         if ((p[0] & 0xFE) == 0xFC) {
             //if (p[0] == 0xFC && (p[1] & 0xFC) == 0x80) {
@@ -1035,6 +1200,61 @@ static Uint32 UTF8_getch(const char **src, size_t *srclen)
     return ch;
 }
 
+/* Decodes a UTF-8 string to UCS-4 code points, skipping byte order marks.
+   Runs of 7-bit ASCII are converted a 32-bit word at a time, without
+   branching per byte.  dst must have room for strlen(src) code points.
+   Returns the number of code points written. */
+static size_t UTF8_to_UCS4(const char *src, Uint32 *dst)
+{
+    size_t srclen = SDL_strlen(src);
+    Uint32 *start = dst;
+
+    while (srclen > 0) {
+        while (srclen >= 4) {
+            Uint32 word;
+            memcpy(&word, src, 4);
+            if (word & 0x80808080) {
+                break;
+            }
+            dst[0] = (Uint8) src[0];
+            dst[1] = (Uint8) src[1];
+            dst[2] = (Uint8) src[2];
+            dst[3] = (Uint8) src[3];
+            dst += 4;
+            src += 4;
+            srclen -= 4;
+        }
+        if (srclen > 0) {
+            Uint32 ch = UTF8_getch(&src, &srclen);
+            if (ch != UNICODE_BOM_NATIVE && ch != UNICODE_BOM_SWAPPED) {
+                *dst++ = ch;
+            }
+        }
+    }
+    return (size_t)(dst - start);
+}
+
+/* Convert a single UCS-4 code point to a UTF-8 string */
+static void UCS4_to_UTF8(Uint32 ch, Uint8 *dst)
+{
+    if (ch <= 0x7F) {
+        *dst++ = (Uint8) ch;
+    } else if (ch <= 0x7FF) {
+        *dst++ = 0xC0 | (Uint8) ((ch >> 6) & 0x1F);
+        *dst++ = 0x80 | (Uint8) (ch & 0x3F);
+    } else if (ch <= 0xFFFF) {
+        *dst++ = 0xE0 | (Uint8) ((ch >> 12) & 0x0F);
+        *dst++ = 0x80 | (Uint8) ((ch >> 6) & 0x3F);
+        *dst++ = 0x80 | (Uint8) (ch & 0x3F);
+    } else {
+        *dst++ = 0xF0 | (Uint8) ((ch >> 18) & 0x07);
+        *dst++ = 0x80 | (Uint8) ((ch >> 12) & 0x3F);
+        *dst++ = 0x80 | (Uint8) ((ch >> 6) & 0x3F);
+        *dst++ = 0x80 | (Uint8) (ch & 0x3F);
+    }
+    *dst = '\0';
+}
+
 int TTF_FontHeight(const TTF_Font *font)
 {
     return(font->height);
@@ -1086,12 +1306,23 @@ char *TTF_FontFaceStyleName(const TTF_Font *font)
 }
 
 int TTF_GlyphIsProvided(const TTF_Font *font, unsigned short ch)
+{
+  return TTF_GlyphIsProvided32(font, ch);
+}
+
+int TTF_GlyphIsProvided32(const TTF_Font *font, uint32_t ch)
 {
   return(FT_Get_Char_Index(font->face, ch));
 }
 
 int TTF_GlyphMetrics(TTF_Font *font, unsigned short ch,
                      int* minx, int* maxx, int* miny, int* maxy, int* advance)
+{
+    return TTF_GlyphMetrics32(font, ch, minx, maxx, miny, maxy, advance);
+}
+
+int TTF_GlyphMetrics32(TTF_Font *font, uint32_t ch,
+                       int* minx, int* maxx, int* miny, int* maxy, int* advance)
 {
     FT_Error error;
 
@@ -1158,7 +1389,8 @@ int TTF_SizeUTF8(TTF_Font *font, const char *text, int *w, int *h)
     FT_Long use_kerning;
     FT_UInt prev_index = 0;
     int outline_delta = 0;
-    size_t textlen;
+    size_t textlen, i;
+    Uint32 *ucs4;
 
     TTF_CHECKPOINTER(text, -1);
 
@@ -1176,13 +1408,11 @@ int TTF_SizeUTF8(TTF_Font *font, const char *text, int *w, int *h)
     }
 
     /* Load each character and sum it's bounding box */
-    textlen = SDL_strlen(text);
+    ucs4 = SDL_stack_alloc(Uint32, SDL_strlen(text));
+    textlen = UTF8_to_UCS4(text, ucs4);
     x= 0;
-    while ( textlen > 0 ) {
-        Uint16 c = UTF8_getch(&text, &textlen);
-        if ( c == UNICODE_BOM_NATIVE || c == UNICODE_BOM_SWAPPED ) {
-            continue;
-        }
+    for ( i = 0; i < textlen; ++i ) {
+        Uint32 c = ucs4[i];
 
         error = Find_Glyph(font, c, CACHED_METRICS);
         if ( error ) {
@@ -1200,10 +1430,8 @@ int TTF_SizeUTF8(TTF_Font *font, const char *text, int *w, int *h)
         glyph = font->current;
 
         /* handle kerning */
-        if ( use_kerning && prev_index && glyph->index ) {
-            FT_Vector delta;
-            FT_Get_Kerning( font->face, prev_index, glyph->index, ft_kerning_default, &delta );
-            x += delta.x >> 6;
+        if ( use_kerning && prev_index && TTF_KERNING_INDEX(font, glyph) ) {
+            x += Get_Kerning( font, prev_index, glyph->index );
         }
 
 #if 0
@@ -1248,8 +1476,9 @@ int TTF_SizeUTF8(TTF_Font *font, const char *text, int *w, int *h)
         if ( glyph->maxy > maxy ) {
             maxy = glyph->maxy;
         }
-        prev_index = glyph->index;
+        prev_index = TTF_KERNING_INDEX(font, glyph);
     }
+    SDL_stack_free(ucs4);
 
     /* Fill the bounds rectangle */
     if ( w ) {
@@ -1356,7 +1585,8 @@ TTF_Surface *TTF_RenderUTF8_Solid(TTF_Font *font,
     FT_Error error;
     FT_Long use_kerning;
     FT_UInt prev_index = 0;
-    size_t textlen;
+    size_t textlen, i;
+    Uint32 *ucs4;
 
     TTF_CHECKPOINTER(text, NULL);
 
@@ -1381,14 +1611,12 @@ TTF_Surface *TTF_RenderUTF8_Solid(TTF_Font *font,
     use_kerning = FT_HAS_KERNING( font->face ) && font->kerning;
 
     /* Load and render each character */
-    textlen = SDL_strlen(text);
+    ucs4 = SDL_stack_alloc(Uint32, SDL_strlen(text));
+    textlen = UTF8_to_UCS4(text, ucs4);
     first = SDL_TRUE;
     xstart = 0;
-    while ( textlen > 0 ) {
-        Uint16 c = UTF8_getch(&text, &textlen);
-        if ( c == UNICODE_BOM_NATIVE || c == UNICODE_BOM_SWAPPED ) {
-            continue;
-        }
+    for ( i = 0; i < textlen; ++i ) {
+        Uint32 c = ucs4[i];
 
         error = Find_Glyph(font, c, CACHED_METRICS|CACHED_BITMAP);
         if ( error ) {
@@ -1414,10 +1642,8 @@ TTF_Surface *TTF_RenderUTF8_Solid(TTF_Font *font,
             width = glyph->maxx - glyph->minx;
         }
         /* do kerning, if possible AC-Patch */
-        if ( use_kerning && prev_index && glyph->index ) {
-            FT_Vector delta;
-            FT_Get_Kerning( font->face, prev_index, glyph->index, ft_kerning_default, &delta );
-            xstart += delta.x >> 6;
+        if ( use_kerning && prev_index && TTF_KERNING_INDEX(font, glyph) ) {
+            xstart += Get_Kerning( font, prev_index, glyph->index );
         }
         /* Compensate for wrap around bug with negative minx's */
         if ( first && (glyph->minx < 0) ) {
@@ -1449,8 +1675,9 @@ TTF_Surface *TTF_RenderUTF8_Solid(TTF_Font *font,
         if ( TTF_HANDLE_STYLE_BOLD(font) ) {
             xstart += font->glyph_overhang;
         }
-        prev_index = glyph->index;
+        prev_index = TTF_KERNING_INDEX(font, glyph);
     }
+    SDL_stack_free(ucs4);
 
 #if 0
 //    /* Handle the underline style */
@@ -1472,10 +1699,14 @@ TTF_Surface *TTF_RenderUTF8_Solid(TTF_Font *font,
 
 TTF_Surface *TTF_RenderGlyph_Solid(TTF_Font *font, unsigned short ch)
 {
-    Uint16 ucs2[2] = { ch, 0 };
-    Uint8 utf8[4];
+    return TTF_RenderGlyph32_Solid(font, ch);
+}
 
-    UCS2_to_UTF8(ucs2, utf8);
+TTF_Surface *TTF_RenderGlyph32_Solid(TTF_Font *font, uint32_t ch)
+{
+    Uint8 utf8[5];
+
+    UCS4_to_UTF8(ch, utf8);
     return TTF_RenderUTF8_Solid(font, (char *)utf8);
 }
 
@@ -1515,7 +1746,8 @@ TTF_Surface *TTF_RenderUTF8_Shaded(TTF_Font *font, const char *text)
     FT_Error error;
     FT_Long use_kerning;
     FT_UInt prev_index = 0;
-    size_t textlen;
+    size_t textlen, i;
+    Uint32 *ucs4;
 
     TTF_CHECKPOINTER(text, NULL);
 
@@ -1540,14 +1772,12 @@ TTF_Surface *TTF_RenderUTF8_Shaded(TTF_Font *font, const char *text)
     use_kerning = FT_HAS_KERNING( font->face ) && font->kerning;
 
     /* Load and render each character */
-    textlen = SDL_strlen(text);
+    ucs4 = SDL_stack_alloc(Uint32, SDL_strlen(text));
+    textlen = UTF8_to_UCS4(text, ucs4);
     first = SDL_FALSE;
     xstart = 0;
-    while ( textlen > 0 ) {
-        Uint16 c = UTF8_getch(&text, &textlen);
-        if ( c == UNICODE_BOM_NATIVE || c == UNICODE_BOM_SWAPPED ) {
-            continue;
-        }
+    for ( i = 0; i < textlen; ++i ) {
+        Uint32 c = ucs4[i];
 
         error = Find_Glyph(font, c, CACHED_METRICS|CACHED_PIXMAP);
         if ( error ) {
@@ -1572,10 +1802,8 @@ TTF_Surface *TTF_RenderUTF8_Shaded(TTF_Font *font, const char *text)
             width = glyph->maxx - glyph->minx;
         }
         /* do kerning, if possible AC-Patch */
-        if ( use_kerning && prev_index && glyph->index ) {
-            FT_Vector delta;
-            FT_Get_Kerning( font->face, prev_index, glyph->index, ft_kerning_default, &delta );
-            xstart += delta.x >> 6;
+        if ( use_kerning && prev_index && TTF_KERNING_INDEX(font, glyph) ) {
+            xstart += Get_Kerning( font, prev_index, glyph->index );
         }
         /* Compensate for the wrap around with negative minx's */
         if ( first && (glyph->minx < 0) ) {
@@ -1606,8 +1834,9 @@ TTF_Surface *TTF_RenderUTF8_Shaded(TTF_Font *font, const char *text)
         if ( TTF_HANDLE_STYLE_BOLD(font) ) {
             xstart += font->glyph_overhang;
         }
-        prev_index = glyph->index;
+        prev_index = TTF_KERNING_INDEX(font, glyph);
     }
+    SDL_stack_free(ucs4);
 
 #if 0
 //    /* Handle the underline style */
@@ -1644,7 +1873,8 @@ void TTF_RenderUTF8_Shaded_Surface(TTF_Surface *dest,
     FT_Error error;
     FT_Long use_kerning;
     FT_UInt prev_index = 0;
-    size_t textlen;
+    size_t textlen, i;
+    Uint32 *ucs4;
 
     TTF_CHECKPOINTER_NO_ERRVAL(text);
 
@@ -1666,14 +1896,12 @@ void TTF_RenderUTF8_Shaded_Surface(TTF_Surface *dest,
     use_kerning = FT_HAS_KERNING( font->face ) && font->kerning;
 
     /* Load and render each character */
-    textlen = SDL_strlen(text);
+    ucs4 = SDL_stack_alloc(Uint32, SDL_strlen(text));
+    textlen = UTF8_to_UCS4(text, ucs4);
     first = SDL_FALSE;
     xstart = 0;
-    while ( textlen > 0 ) {
-        Uint16 c = UTF8_getch(&text, &textlen);
-        if ( c == UNICODE_BOM_NATIVE || c == UNICODE_BOM_SWAPPED ) {
-            continue;
-        }
+    for ( i = 0; i < textlen; ++i ) {
+        Uint32 c = ucs4[i];
 
         error = Find_Glyph(font, c, CACHED_METRICS|CACHED_PIXMAP);
         if ( error ) {
@@ -1696,10 +1924,8 @@ void TTF_RenderUTF8_Shaded_Surface(TTF_Surface *dest,
             width = glyph->maxx - glyph->minx;
         }
         /* do kerning, if possible AC-Patch */
-        if ( use_kerning && prev_index && glyph->index ) {
-            FT_Vector delta;
-            FT_Get_Kerning( font->face, prev_index, glyph->index, ft_kerning_default, &delta );
-            xstart += delta.x >> 6;
+        if ( use_kerning && prev_index && TTF_KERNING_INDEX(font, glyph) ) {
+            xstart += Get_Kerning( font, prev_index, glyph->index );
         }
         /* Compensate for the wrap around with negative minx's */
         if ( first && (glyph->minx < 0) ) {
@@ -1730,17 +1956,22 @@ void TTF_RenderUTF8_Shaded_Surface(TTF_Surface *dest,
         if ( TTF_HANDLE_STYLE_BOLD(font) ) {
             xstart += font->glyph_overhang;
         }
-        prev_index = glyph->index;
+        prev_index = TTF_KERNING_INDEX(font, glyph);
     }
+    SDL_stack_free(ucs4);
 }
 
 
 TTF_Surface* TTF_RenderGlyph_Shaded(TTF_Font *font, unsigned short ch)
 {
-    Uint16 ucs2[2] = { ch, 0 };
-    Uint8 utf8[4];
+    return TTF_RenderGlyph32_Shaded(font, ch);
+}
+
+TTF_Surface* TTF_RenderGlyph32_Shaded(TTF_Font *font, uint32_t ch)
+{
+    Uint8 utf8[5];
 
-    UCS2_to_UTF8(ucs2, utf8);
+    UCS4_to_UTF8(ch, utf8);
     return TTF_RenderUTF8_Shaded(font, (char *)utf8);
 }
 
@@ -1804,7 +2035,7 @@ void TTF_Quit( void )
 {
     if ( TTF_initialized ) {
         if ( --TTF_initialized == 0 ) {
-            FT_Done_FreeType( library );
+            ramefont_done();
         }
     }
 }
@@ -1815,6 +2046,11 @@ int TTF_WasInit( void )
 }
 
 int TTF_GetFontKerningSizeGlyphs(TTF_Font *font, Uint16 previous_ch, Uint16 ch)
+{
+    return TTF_GetFontKerningSizeGlyphs32(font, previous_ch, ch);
+}
+
+int TTF_GetFontKerningSizeGlyphs32(TTF_Font *font, Uint32 previous_ch, Uint32 ch)
 {
     int error;
     int glyph_index, prev_index;
@@ -1833,14 +2069,17 @@ int TTF_GetFontKerningSizeGlyphs(TTF_Font *font, Uint16 previous_ch, Uint16 ch)
         TTF_SetFTError("Couldn't find glyph", error);
         return -1;
     }
-    glyph_index = font->current->index;
+    glyph_index = TTF_KERNING_INDEX(font, font->current);
 
     error = Find_Glyph(font, previous_ch, CACHED_METRICS);
     if (error) {
         TTF_SetFTError("Couldn't find glyph", error);
         return -1;
     }
-    prev_index = font->current->index;
+    prev_index = TTF_KERNING_INDEX(font, font->current);
+    if (!glyph_index || !prev_index) {
+        return 0;
+    }
 
     error = FT_Get_Kerning(font->face, prev_index, glyph_index, ft_kerning_default, &delta);
     if (error) {
@@ -34,6 +34,8 @@
 #ifndef _TTF_H
 #define _TTF_H
 
+#include <stdint.h>
+
 
 /* Set up for C function definitions, even when using C++ */
 #ifdef __cplusplus
@@ -86,6 +88,13 @@ extern int TTF_Init(void);
 extern TTF_Font * TTF_OpenFont(const char *file, int ptsize);
 extern TTF_Font * TTF_OpenFontIndex(const char *file, int ptsize, long index);
 
+/* Add a fallback font used for code points the font doesn't provide.
+ * Fallbacks are searched in the order added, and each is opened at the
+ * same point size only when a missing glyph is first looked up.
+ * Returns 0 if successful, -1 on error. */
+#define TTF_MAX_FALLBACK_FONTS  4
+extern int TTF_AddFallbackFont(TTF_Font *font, const char *file);
+
 /* Set and retrieve the font style */
 #define TTF_STYLE_NORMAL        0x00
 #define TTF_STYLE_BOLD          0x01
@@ -135,6 +144,7 @@ extern char * TTF_FontFaceStyleName(const TTF_Font *font);
 
 /* Check wether a glyph is provided by the font or not */
 extern int TTF_GlyphIsProvided(const TTF_Font *font, unsigned short ch);
+extern int TTF_GlyphIsProvided32(const TTF_Font *font, uint32_t ch);
 
 /* Get the metrics (dimensions) of a glyph
    To understand what these metrics mean, here is a useful link:
@@ -143,6 +153,9 @@ extern int TTF_GlyphIsProvided(const TTF_Font *font, unsigned short ch);
 extern int TTF_GlyphMetrics(TTF_Font *font, unsigned short ch,
                             int *minx, int *maxx,
                             int *miny, int *maxy, int *advance);
+extern int TTF_GlyphMetrics32(TTF_Font *font, uint32_t ch,
+                              int *minx, int *maxx,
+                              int *miny, int *maxy, int *advance);
 
 /* Get the dimensions of a rendered string of text */
 extern int TTF_SizeText(TTF_Font *font, const char *text, int *w, int *h);
@@ -160,6 +173,7 @@ extern TTF_Surface * TTF_RenderUTF8_Solid(TTF_Font *font, const char *text);
    This function returns the new surface, or NULL if there was an error.
 */
 extern TTF_Surface * TTF_RenderGlyph_Solid(TTF_Font *font, unsigned short ch);
+extern TTF_Surface * TTF_RenderGlyph32_Solid(TTF_Font *font, uint32_t ch);
 
 /* Create a surface surface and render the given text at high quality.
    This function returns the new surface, or NULL if there was an error.
@@ -178,6 +192,7 @@ extern void TTF_RenderUTF8_Shaded_Surface(TTF_Surface *dest,
    This function returns the new surface, or NULL if there was an error.
 */
 extern TTF_Surface * TTF_RenderGlyph_Shaded(TTF_Font *font, unsigned short ch);
+extern TTF_Surface * TTF_RenderGlyph32_Shaded(TTF_Font *font, uint32_t ch);
 
 
 /* Close an opened font file */
@@ -191,6 +206,7 @@ extern int TTF_WasInit(void);
 
 /* Get the kerning size of two glyphs */
 extern int TTF_GetFontKerningSizeGlyphs(TTF_Font *font, unsigned short previous_ch, unsigned short ch);
+extern int TTF_GetFontKerningSizeGlyphs32(TTF_Font *font, uint32_t previous_ch, uint32_t ch);
 
 extern char * TTF_GetError(void);
 
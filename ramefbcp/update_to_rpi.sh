@@ -4,6 +4,7 @@ REMOTE=root@$IP
 REMOTE_FOLDER=ramefbcp/
 TARGET=$REMOTE:$REMOTE_FOLDER
 
-ssh $REMOTE "mkdir $REMOTE_FOLDER"
+ssh $REMOTE "mkdir $REMOTE_FOLDER librameutil"
 scp CMakeLists.txt README.md main.c debug.* infodisplay.* icon-data.h ttf.* input.* $TARGET
+scp ../librameutil/ramefont.* ../librameutil/ramebus.* $REMOTE:librameutil/
 ssh $REMOTE "cd ramefbcp; rm ramefbcp; mkdir -p build; cd build; cmake ..; make; mv ramefbcp ..; cd ..; ls -al ramefbcp"
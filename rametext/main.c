@@ -37,13 +37,13 @@ static void draw(state_t *s, const char *text)
 	size_t n;
 	int i;
 
-	f = font_load(s, "FreeSerif", 0, 96);
+	n = mbstowcs(wcs, text, sizeof wcs / sizeof wcs[0]);
+	f = font_load(s, "FreeSerif", 0, 96, n != (size_t)-1 ? wcs : NULL);
 	vgClear(0, 0, s->screen_width, s->screen_height);
 
 	setfill(white);
 	//setstroke(white, 5);
 
-	n = mbstowcs(wcs, text, sizeof wcs / sizeof wcs[0]);
 	if (n != (size_t)-1) {
 		font_get_text_extent(f, wcs, &w, &h);
 		font_draw_text(f, wcs, (s->screen_width-w)/2, (s->screen_height-h)/2, VG_FILL_PATH);